@@ -5,209 +5,3916 @@
 #include <chrono>
 #include <algorithm>
 #include <cctype>
-#include <set>
+#include <unordered_map>
 #include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <memory>
+#include <cstdio>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 using namespace std::chrono;
 
-// Struct to hold data related to a flight
-struct Flight {
-    string carrier;        // airline carrier code
-    string airport_name;   // airport where the flight is scheduled to land
-    int arr_delay;         // arrival delay time in minutes
-};
+// Struct to hold data related to a flight; carrier and airport are ids into the FlightTable dictionaries
+struct Flight {
+    int32_t arr_delay;     // arrival delay time in minutes
+    uint16_t carrier_id;   // airline carrier code, as an index into FlightTable::carriers
+    uint16_t airport_id;   // airport where the flight is scheduled to land, as an index into FlightTable::airports
+};
+
+// Class to intern strings as dense 16-bit ids. Lookups take a pointer and length, so
+// looking up a field never builds a std::string; only a newly seen string is copied.
+class StringDictionary {
+public:
+    static const size_t MAX_ENTRIES = 0xFFFF;
+
+    // Returns the id of the string, or -1 if it has not been interned
+    int find(const char* data, size_t size) const {
+        if (slots.empty()) return -1;
+        size_t mask = slots.size() - 1;
+        for (size_t slot = hash(data, size) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+            const string& candidate = names[slots[slot] - 1];
+            if (candidate.size() == size && memcmp(candidate.data(), data, size) == 0) {
+                return static_cast<int>(slots[slot] - 1);
+            }
+        }
+        return -1;
+    }
+
+    int find(const string& str) const { return find(str.data(), str.size()); }
+
+    // Returns the id of the string, adding it if needed; -1 once the dictionary is full
+    int intern(const char* data, size_t size) {
+        if ((names.size() + 1) * 2 > slots.size()) {
+            rehash(max<size_t>(64, slots.size() * 2));  // keep the table at most half full
+        }
+        size_t mask = slots.size() - 1;
+        size_t slot = hash(data, size) & mask;
+        for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+            const string& candidate = names[slots[slot] - 1];
+            if (candidate.size() == size && memcmp(candidate.data(), data, size) == 0) {
+                return static_cast<int>(slots[slot] - 1);
+            }
+        }
+        if (names.size() >= MAX_ENTRIES) return -1;
+        names.emplace_back(data, size);
+        slots[slot] = static_cast<uint32_t>(names.size());
+        return static_cast<int>(names.size() - 1);
+    }
+
+    int intern(const string& str) { return intern(str.data(), str.size()); }
+
+    const string& name(size_t id) const { return names[id]; }
+    size_t size() const { return names.size(); }
+
+private:
+    // FNV-1a over the bytes of the string
+    static size_t hash(const char* data, size_t size) {
+        uint64_t value = 14695981039346656037ULL;
+        for (size_t i = 0; i < size; ++i) {
+            value = (value ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+        }
+        return static_cast<size_t>(value ^ (value >> 32));
+    }
+
+    void rehash(size_t slotCount) {
+        slots.assign(slotCount, 0);
+        size_t mask = slotCount - 1;
+        for (size_t id = 0; id < names.size(); ++id) {
+            size_t slot = hash(names[id].data(), names[id].size()) & mask;
+            while (slots[slot] != 0) slot = (slot + 1) & mask;
+            slots[slot] = static_cast<uint32_t>(id + 1);
+        }
+    }
+
+    vector<string> names;   // id -> string
+    vector<uint32_t> slots; // open-addressed hash table of id + 1; 0 marks an empty slot
+};
+
+// Function to return the index of the lowest set bit of a non-zero mask
+inline int lowestSetBit(uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+// Function to count the set bits of a mask
+inline int countSetBits(uint64_t mask) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(mask));
+#else
+    return __builtin_popcountll(mask);
+#endif
+}
+
+// Function to lowercase an ASCII letter; other bytes are returned unchanged
+inline unsigned char foldCase(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c | 0x20) : c;
+}
+
+#if defined(__AVX2__)
+// Function to lowercase the ASCII letters among 32 bytes
+inline __m256i foldCase(__m256i bytes) {
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), bytes));
+    return _mm256_or_si256(bytes, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+// Function to lowercase the ASCII letters among 16 bytes
+inline __m128i foldCase(__m128i bytes) {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), bytes));
+    return _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+// Function to compare length bytes of text, lowercased, with lower (already lowercase), 32 (AVX2) or 16
+// (SSE2) bytes per compare
+inline bool equalsIgnoreCase(const char* text, const char* lower, size_t length) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= length; i += 32) {
+        __m256i folded = foldCase(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i)));
+        __m256i expected = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lower + i));
+        if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(folded, expected))) != 0xFFFFFFFFu) return false;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 16 <= length; i += 16) {
+        __m128i folded = foldCase(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i)));
+        __m128i expected = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lower + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(folded, expected)) != 0xFFFF) return false;
+    }
+#endif
+    for (; i < length; ++i) {
+        if (foldCase(static_cast<unsigned char>(text[i])) != static_cast<unsigned char>(lower[i])) return false;
+    }
+    return true;
+}
+
+// Function to test whether text contains lower (already lowercase) when text is lowercased. A vector of
+// start positions is screened at once by the first and last byte of lower; survivors are compared in full.
+inline bool containsIgnoreCase(const string& text, const string& lower) {
+    size_t length = lower.size();
+    if (length == 0) return true;
+    if (length > text.size()) return false;
+    size_t starts = text.size() - length + 1;  // possible start positions
+    const char* data = text.data();
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(lower[0]);
+    const __m256i last = _mm256_set1_epi8(lower[length - 1]);
+    for (; i + 32 <= starts; i += 32) {
+        __m256i heads = foldCase(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+        __m256i tails = foldCase(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + length - 1)));
+        uint64_t candidates = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(heads, first), _mm256_cmpeq_epi8(tails, last))));
+        for (; candidates != 0; candidates &= candidates - 1) {
+            if (equalsIgnoreCase(data + i + lowestSetBit(candidates), lower.data(), length)) return true;
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i first = _mm_set1_epi8(lower[0]);
+    const __m128i last = _mm_set1_epi8(lower[length - 1]);
+    for (; i + 16 <= starts; i += 16) {
+        __m128i heads = foldCase(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+        __m128i tails = foldCase(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + length - 1)));
+        uint64_t candidates = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(heads, first), _mm_cmpeq_epi8(tails, last))));
+        for (; candidates != 0; candidates &= candidates - 1) {
+            if (equalsIgnoreCase(data + i + lowestSetBit(candidates), lower.data(), length)) return true;
+        }
+    }
+#endif
+    for (; i < starts; ++i) {  // the starts left over after the last full vector
+        if (equalsIgnoreCase(data + i, lower.data(), length)) return true;
+    }
+    return false;
+}
+
+// Airport names suggested at most when a search matches no name
+const size_t AIRPORT_SUGGESTIONS = 5;
+// Share of the query's trigrams a name must contain to be suggested
+const double TRIGRAM_MIN_SIMILARITY = 0.5;
+
+// Class to index the names of a StringDictionary by trigram, for case-insensitive substring search and ranked
+// fuzzy matching. Each name is lowercased and split into words of letters and digits; every word is padded
+// with two spaces in front and one behind ("  word ") and contributes its three-byte substrings. Each
+// trigram maps to the ascending ids of the names containing it.
+class TrigramIndex {
+public:
+    // Builds the index over every name of the dictionary
+    void build(const StringDictionary& names) {
+        vector<pair<uint32_t, uint16_t>> entries;  // (trigram, id), one per distinct trigram of each name
+        vector<uint32_t> nameGrams;
+        gramCounts.assign(names.size(), 0);
+        for (size_t id = 0; id < names.size(); ++id) {
+            wordTrigrams(names.name(id), nameGrams);
+            gramCounts[id] = static_cast<uint32_t>(nameGrams.size());
+            for (uint32_t gram : nameGrams) {
+                entries.push_back(make_pair(gram, static_cast<uint16_t>(id)));
+            }
+        }
+        sort(entries.begin(), entries.end());
+
+        grams.clear();
+        offsets.clear();
+        ids.resize(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (i == 0 || entries[i].first != entries[i - 1].first) {
+                grams.push_back(entries[i].first);
+                offsets.push_back(static_cast<uint32_t>(i));
+            }
+            ids[i] = entries[i].second;
+        }
+        offsets.push_back(static_cast<uint32_t>(entries.size()));
+    }
+
+    // Returns the ascending ids of the names containing text, ignoring case. Trigrams of the text that lie
+    // inside one word must occur in any name containing it, so only the names on all of their lists are
+    // verified; text without such a trigram is verified against every name.
+    vector<uint16_t> findSubstring(const StringDictionary& names, const string& text) const {
+        string lower(text.size(), '\0');
+        for (size_t i = 0; i < text.size(); ++i) {
+            lower[i] = static_cast<char>(foldCase(static_cast<unsigned char>(text[i])));
+        }
+
+        vector<uint16_t> candidates;
+        bool filtered = false;  // whether candidates holds the intersection of at least one list
+        for (size_t i = 0; i + 3 <= lower.size(); ++i) {
+            if (!isWordByte(lower[i]) || !isWordByte(lower[i + 1]) || !isWordByte(lower[i + 2])) continue;
+            size_t index = lookup(trigram(lower[i], lower[i + 1], lower[i + 2]));
+            if (index == grams.size()) return vector<uint16_t>();  // no name has this trigram
+            const uint16_t* first = ids.data() + offsets[index];
+            const uint16_t* last = ids.data() + offsets[index + 1];
+            if (!filtered) {
+                candidates.assign(first, last);
+                filtered = true;
+            } else {
+                candidates.erase(set_intersection(candidates.begin(), candidates.end(), first, last, candidates.begin()),
+                                 candidates.end());
+            }
+            if (candidates.empty()) return candidates;
+        }
+        if (!filtered) {
+            for (size_t id = 0; id < names.size(); ++id) {
+                candidates.push_back(static_cast<uint16_t>(id));
+            }
+        }
+
+        vector<uint16_t> matches;
+        for (uint16_t id : candidates) {
+            if (containsIgnoreCase(names.name(id), lower)) {
+                matches.push_back(id);
+            }
+        }
+        return matches;
+    }
+
+    // Returns up to limit ids of the names sharing the most trigrams with text, best first. A name's score is
+    // the share of the text's trigrams it contains (so a partial name still matches a long one); names
+    // scoring below minSimilarity are left out, and ties go to the name with fewer trigrams.
+    vector<uint16_t> findSimilar(const string& text, size_t limit, double minSimilarity) const {
+        vector<uint32_t> textGrams;
+        wordTrigrams(text, textGrams);
+        if (textGrams.empty()) return vector<uint16_t>();
+
+        vector<uint32_t> shared(gramCounts.size(), 0);  // trigrams each name shares with the text
+        for (uint32_t gram : textGrams) {
+            size_t index = lookup(gram);
+            if (index == grams.size()) continue;
+            for (uint32_t i = offsets[index]; i < offsets[index + 1]; ++i) {
+                ++shared[ids[i]];
+            }
+        }
+
+        uint32_t minShared = static_cast<uint32_t>(ceil(minSimilarity * textGrams.size()));
+        vector<uint16_t> ranked;
+        for (size_t id = 0; id < shared.size(); ++id) {
+            if (shared[id] > 0 && shared[id] >= minShared) {
+                ranked.push_back(static_cast<uint16_t>(id));
+            }
+        }
+        auto better = [&](uint16_t a, uint16_t b) {
+            if (shared[a] != shared[b]) return shared[a] > shared[b];
+            if (gramCounts[a] != gramCounts[b]) return gramCounts[a] < gramCounts[b];
+            return a < b;
+        };
+        size_t kept = min(limit, ranked.size());
+        partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end(), better);
+        ranked.resize(kept);
+        return ranked;
+    }
+
+private:
+    static bool isWordByte(char c) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        return isalnum(byte) || byte >= 0x80;  // keep multi-byte UTF-8 characters inside their word
+    }
+
+    static uint32_t trigram(char a, char b, char c) {
+        return (static_cast<uint32_t>(static_cast<unsigned char>(a)) << 16) |
+               (static_cast<uint32_t>(static_cast<unsigned char>(b)) << 8) | static_cast<unsigned char>(c);
+    }
+
+    // Function to collect the distinct trigrams of the padded, lowercased words of text
+    static void wordTrigrams(const string& text, vector<uint32_t>& out) {
+        out.clear();
+        string word = "  ";
+        for (size_t i = 0; i <= text.size(); ++i) {
+            if (i < text.size() && isWordByte(text[i])) {
+                word.push_back(static_cast<char>(foldCase(static_cast<unsigned char>(text[i]))));
+                continue;
+            }
+            if (word.size() > 2) {
+                word.push_back(' ');
+                for (size_t j = 0; j + 3 <= word.size(); ++j) {
+                    out.push_back(trigram(word[j], word[j + 1], word[j + 2]));
+                }
+            }
+            word.resize(2);
+        }
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+    }
+
+    // Returns the position of gram in grams, or grams.size() when no name has it
+    size_t lookup(uint32_t gram) const {
+        auto it = lower_bound(grams.begin(), grams.end(), gram);
+        return (it != grams.end() && *it == gram) ? static_cast<size_t>(it - grams.begin()) : grams.size();
+    }
+
+    vector<uint32_t> grams;      // distinct trigrams, ascending
+    vector<uint32_t> offsets;    // grams[i] -> start of its ids; the last entry is the total
+    vector<uint16_t> ids;        // ids of the names holding each trigram, ascending per trigram
+    vector<uint32_t> gramCounts; // id -> number of distinct trigrams in the name
+};
+
+// Class to list the rows holding each value of a dense id column, as one flat array of row ids grouped by
+// id (a counting sort of the row ids by id). The rows of id i are contiguous and in row order.
+class RowIndex {
+public:
+    // Builds the index over column, whose values are below ids
+    void build(const vector<uint16_t>& column, size_t ids) {
+        offsets.assign(ids + 1, 0);
+        for (uint16_t id : column) {
+            ++offsets[id + 1];
+        }
+        for (size_t id = 0; id < ids; ++id) {
+            offsets[id + 1] += offsets[id];
+        }
+        rows.resize(column.size());
+        vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+        for (size_t row = 0; row < column.size(); ++row) {
+            rows[next[column[row]]++] = static_cast<uint32_t>(row);
+        }
+    }
+
+    // Replaces the rows of each id with rowIds, which must hold every row of the column grouped the same
+    // way (e.g. reordered within each id); returns false, leaving the index empty, if it does not
+    bool assign(const vector<uint16_t>& column, size_t ids, const uint32_t* rowIds) {
+        build(column, ids);
+        vector<char> seen(column.size(), 0);
+        for (size_t id = 0; id < ids; ++id) {
+            for (uint32_t i = offsets[id]; i < offsets[id + 1]; ++i) {
+                uint32_t row = rowIds[i];
+                if (row >= column.size() || column[row] != id || seen[row]) {
+                    *this = RowIndex();
+                    return false;
+                }
+                seen[row] = 1;
+                rows[i] = row;
+            }
+        }
+        return true;
+    }
+
+    const uint32_t* begin(size_t id) const { return rows.data() + offsets[id]; }
+    const uint32_t* end(size_t id) const { return rows.data() + offsets[id + 1]; }
+    uint32_t* begin(size_t id) { return rows.data() + offsets[id]; }
+    uint32_t* end(size_t id) { return rows.data() + offsets[id + 1]; }
+    size_t count(size_t id) const { return offsets[id + 1] - offsets[id]; }
+    size_t ids() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    const vector<uint32_t>& rowIds() const { return rows; }  // every row id, grouped by id
+
+private:
+    vector<uint32_t> offsets;  // id -> start of its rows; offsets[ids] is the row count
+    vector<uint32_t> rows;     // row ids grouped by id
+};
+
+// Struct to hold flight data column by column: dense delay and id arrays plus the dictionaries the ids index
+struct FlightTable {
+    vector<int32_t> arr_delay;   // arrival delay time in minutes
+    vector<uint16_t> carrier_id; // index into carriers
+    vector<uint16_t> airport_id; // index into airports
+    StringDictionary carriers;   // airline carrier codes
+    StringDictionary airports;   // airport names
+    RowIndex carrierRows;        // rows of each carrier, built once loading is done
+    RowIndex airportRows;        // rows of each airport, built once loading is done
+    TrigramIndex airportGrams;   // trigrams of the airport names, for substring and fuzzy search
+    bool delayPartitions = false; // whether the two indexes below are built
+    RowIndex carrierRowsByDelay; // rows of each carrier ordered by arr_delay, then row
+    RowIndex airportRowsByDelay; // rows of each airport ordered by arr_delay, then row
+
+    size_t size() const { return arr_delay.size(); }
+    bool empty() const { return arr_delay.empty(); }
+
+    void reserve(size_t rows) {
+        arr_delay.reserve(rows);
+        carrier_id.reserve(rows);
+        airport_id.reserve(rows);
+    }
+
+    void resize(size_t rows) {
+        arr_delay.resize(rows);
+        carrier_id.resize(rows);
+        airport_id.resize(rows);
+    }
+
+    void append(uint16_t carrier, uint16_t airport, int32_t delay) {
+        arr_delay.push_back(delay);
+        carrier_id.push_back(carrier);
+        airport_id.push_back(airport);
+    }
+
+    // Builds the row indexes over the loaded columns
+    void buildIndexes() {
+        carrierRows.build(carrier_id, carriers.size());
+        airportRows.build(airport_id, airports.size());
+        airportGrams.build(airports);
+    }
+
+    // Returns row i as a Flight record
+    Flight row(size_t i) const {
+        Flight flight;
+        flight.arr_delay = arr_delay[i];
+        flight.carrier_id = carrier_id[i];
+        flight.airport_id = airport_id[i];
+        return flight;
+    }
+};
+
+// Function to select the rows of every airport whose name contains text, ignoring case, in row order.
+// The trigram index finds the matching airport names and the rows come from the airport index.
+// Returns the ids of the matching airports.
+vector<uint16_t> findAirportRows(const FlightTable& flights, const string& text, vector<uint32_t>& rows) {
+    vector<uint16_t> matches = flights.airportGrams.findSubstring(flights.airports, text);  // matching airport ids
+    size_t matchedRows = 0;
+    for (uint16_t id : matches) {
+        matchedRows += flights.airportRows.count(id);
+    }
+
+    rows.clear();
+    if (matches.size() == 1) {
+        rows.assign(flights.airportRows.begin(matches[0]), flights.airportRows.end(matches[0]));  // already in row order
+    } else if (matchedRows * 8 < flights.size()) {
+        rows.reserve(matchedRows);
+        for (uint16_t id : matches) {
+            rows.insert(rows.end(), flights.airportRows.begin(id), flights.airportRows.end(id));
+        }
+        sort(rows.begin(), rows.end());  // interleave the airports back into row order
+    } else if (!matches.empty()) {
+        // A broad match selects a large share of the table; one pass over the id column is cheaper than sorting
+        vector<char> matched(flights.airports.size(), 0);
+        for (uint16_t id : matches) {
+            matched[id] = 1;
+        }
+        rows.reserve(matchedRows);
+        for (size_t i = 0; i < flights.size(); ++i) {
+            if (matched[flights.airport_id[i]]) {
+                rows.push_back(static_cast<uint32_t>(i));
+            }
+        }
+    }
+    return matches;
+}
+
+// Options controlling how readFlightData loads the CSV file
+struct IngestOptions {
+    bool useMemoryMap = true;  // map the file into memory instead of reading it through a stream
+    unsigned threads = 0;      // parser threads; 0 uses every hardware thread, 1 parses serially
+    bool useSnapshot = false;  // load from / save to a binary snapshot next to the CSV file
+    bool presort = false;      // order the rows of each carrier and airport by arr_delay at load time
+};
+
+// Tally of the values rejected in one numeric column
+struct NumericColumnStats {
+    size_t empty = 0;       // blank cells
+    size_t invalid = 0;     // cells that are not a decimal number, such as NA
+    size_t outOfRange = 0;  // numbers that do not fit the column type
+
+    size_t rejected() const { return empty + invalid + outOfRange; }
+
+    void add(const NumericColumnStats& other) {
+        empty += other.empty;
+        invalid += other.invalid;
+        outOfRange += other.outOfRange;
+    }
+};
+
+// Counters describing what readFlightData did with the records of a file
+struct IngestStats {
+    size_t records = 0;         // non-empty records after the header
+    size_t accepted = 0;        // records stored as flights
+    size_t shortRecords = 0;    // records with fewer fields than the required columns
+    size_t dictionaryFull = 0;  // records whose carrier or airport no longer fit a 16-bit dictionary
+    NumericColumnStats arr_delay;  // rejected arrival delay values
+
+    void add(const IngestStats& other) {
+        records += other.records;
+        accepted += other.accepted;
+        shortRecords += other.shortRecords;
+        dictionaryFull += other.dictionaryFull;
+        arr_delay.add(other.arr_delay);
+    }
+};
+
+// Positions of the columns readFlightData keeps from each record
+struct ColumnIndices {
+    int carrier = -1;
+    int airport_name = -1;
+    int arr_delay = -1;
+};
+
+// Smallest slice of the file worth handing to its own parser thread
+const size_t MIN_PARSE_CHUNK_BYTES = 1 << 20;
+
+// Function to run task(i) for every i in [0, count) on its own thread and wait for all of them
+template <typename Task>
+void runOnThreads(size_t count, Task task) {
+    vector<thread> workers;
+    for (size_t i = 1; i < count; ++i) {
+        workers.emplace_back(task, i);
+    }
+    if (count > 0) task(0);  // the calling thread takes the first slice itself
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Class holding a read-only view of a whole file, memory-mapped when possible
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // Opens the file, falling back to reading it into memory if mapping fails or is disabled
+    bool open(const string& filename, bool useMemoryMap) {
+        close();
+        if (useMemoryMap && map(filename)) {
+            return true;
+        }
+        ifstream file(filename, ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        begin = buffer.data();
+        length = buffer.size();
+        return true;
+    }
+
+    const char* data() const { return begin; }
+    size_t size() const { return length; }
+    bool isMapped() const { return mapped; }
+
+    void close() {
+        if (mapped) {
+#ifdef _WIN32
+            UnmapViewOfFile(begin);
+#else
+            munmap(const_cast<char*>(begin), length);
+#endif
+        }
+        mapped = false;
+        begin = nullptr;
+        length = 0;
+        buffer.clear();
+    }
+
+private:
+    // Maps the whole file read-only; returns false so the caller can fall back to a plain read
+    bool map(const string& filename) {
+#ifdef _WIN32
+        HANDLE fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+            CloseHandle(fileHandle);
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(fileHandle);  // the mapping keeps its own reference to the file
+        if (mapping == nullptr) return false;
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);  // the view keeps the mapping alive
+        if (view == nullptr) return false;
+        begin = static_cast<const char*>(view);
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);  // the mapping stays valid after the descriptor is closed
+        if (view == MAP_FAILED) return false;
+        madvise(view, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);  // hint a front-to-back scan
+        begin = static_cast<const char*>(view);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        mapped = true;
+        return true;
+    }
+
+    const char* begin = nullptr;  // first byte of the file contents
+    size_t length = 0;            // number of bytes in the file
+    bool mapped = false;          // true when begin points into a memory mapping
+    vector<char> buffer;          // file contents when mapping is unavailable
+};
+
+// Bitmasks of the structural characters in one block of up to 64 bytes; bit i describes byte i
+struct StructuralMasks {
+    uint64_t delimiter = 0;  // bytes equal to the field delimiter
+    uint64_t quote = 0;      // '"' bytes
+    uint64_t newline = 0;    // '\n' bytes
+};
+
+// Function to turn a quote mask into an inside-quotes mask: bit i is set when an odd number of quotes ends at byte i
+inline uint64_t prefixXor(uint64_t mask) {
+    mask ^= mask << 1;
+    mask ^= mask << 2;
+    mask ^= mask << 4;
+    mask ^= mask << 8;
+    mask ^= mask << 16;
+    mask ^= mask << 32;
+    return mask;
+}
+
+// Function to classify 64 readable bytes at p, 32 (AVX2) or 16 (SSE2) bytes per compare
+inline StructuralMasks scanFullBlock(const char* p, char delimiter) {
+    StructuralMasks masks;
+#if defined(__AVX2__)
+    const __m256i delimiters = _mm256_set1_epi8(delimiter);
+    const __m256i quotes = _mm256_set1_epi8('"');
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    for (int half = 0; half < 2; ++half) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + half * 32));
+        int shift = half * 32;
+        masks.delimiter |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, delimiters)))) << shift;
+        masks.quote |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, quotes)))) << shift;
+        masks.newline |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newlines)))) << shift;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i delimiters = _mm_set1_epi8(delimiter);
+    const __m128i quotes = _mm_set1_epi8('"');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    for (int quarter = 0; quarter < 4; ++quarter) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + quarter * 16));
+        int shift = quarter * 16;
+        masks.delimiter |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, delimiters)))) << shift;
+        masks.quote |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quotes)))) << shift;
+        masks.newline |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newlines)))) << shift;
+    }
+#else
+    for (int i = 0; i < 64; ++i) {  // scalar fallback for targets without SSE2
+        uint64_t bit = uint64_t(1) << i;
+        if (p[i] == delimiter) masks.delimiter |= bit;
+        if (p[i] == '"') masks.quote |= bit;
+        if (p[i] == '\n') masks.newline |= bit;
+    }
+#endif
+    return masks;
+}
+
+// Function to classify the first min(64, last - p) bytes at p without reading past last
+inline StructuralMasks scanStructuralBlock(const char* p, const char* last, char delimiter) {
+    if (last - p >= 64) {
+        return scanFullBlock(p, delimiter);
+    }
+    char padded[64] = {};  // copy the tail so the vector loads stay inside the buffer
+    size_t length = last - p;
+    memcpy(padded, p, length);
+    StructuralMasks masks = scanFullBlock(padded, delimiter);
+    uint64_t valid = length == 0 ? 0 : (~uint64_t(0) >> (64 - length));  // drop matches in the padding
+    masks.delimiter &= valid;
+    masks.quote &= valid;
+    masks.newline &= valid;
+    return masks;
+}
+
+// Class to walk the delimiters and quotes of a byte range one 64-byte block at a time
+class StructuralScanner {
+public:
+    StructuralScanner(const char* first, const char* last, char delimiter)
+        : blockStart(first), last(last), delimiter(delimiter) {
+        load(first);
+    }
+
+    // Returns the first delimiter or quote at or after from, or last if there is none
+    const char* next(const char* from) {
+        while (from < last) {
+            if (from >= blockStart + 64) {
+                load(from);
+            }
+            uint64_t remaining = pending & (~uint64_t(0) << (from - blockStart));  // skip bytes already consumed
+            if (remaining != 0) {
+                return blockStart + lowestSetBit(remaining);
+            }
+            from = blockStart + 64;
+        }
+        return last;
+    }
+
+private:
+    void load(const char* from) {
+        blockStart = from;
+        StructuralMasks masks = scanStructuralBlock(from, last, delimiter);
+        pending = masks.delimiter | masks.quote;
+    }
+
+    const char* blockStart;  // first byte of the block described by pending
+    const char* last;        // end of the range being scanned
+    char delimiter;          // field delimiter being searched for
+    uint64_t pending = 0;    // delimiter and quote positions in the current block
+};
+
+// Function to pick the field delimiter for a header line: tab if it contains one, comma otherwise
+char detectDelimiter(const char* first, const char* last) {
+    for (const char* p = first; p < last; p += 64) {
+        if (scanStructuralBlock(p, last, '\t').delimiter != 0) {
+            return '\t';
+        }
+    }
+    return ',';
+}
+
+// Function to find the first newline outside quotes in [first, last), or last if there is none.
+// inside_quotes holds the quote state at first on entry and the state where the search stopped on return.
+const char* findUnquotedNewline(const char* first, const char* last, bool& inside_quotes) {
+    for (const char* p = first; p < last; p += 64) {
+        StructuralMasks masks = scanStructuralBlock(p, last, ',');
+        uint64_t quoted = prefixXor(masks.quote) ^ (inside_quotes ? ~uint64_t(0) : 0);
+        uint64_t recordEnds = masks.newline & ~quoted;
+        if (recordEnds != 0) {
+            inside_quotes = false;
+            return p + lowestSetBit(recordEnds);
+        }
+        inside_quotes ^= (countSetBits(masks.quote) & 1) != 0;
+    }
+    return last;
+}
+
+// Function to count the quote characters in [first, last)
+size_t countQuotes(const char* first, const char* last) {
+    size_t quotes = 0;
+    for (const char* p = first; p < last; p += 64) {
+        quotes += countSetBits(scanStructuralBlock(p, last, ',').quote);
+    }
+    return quotes;
+}
+
+// Function to trim leading and trailing whitespaces from a string
+string trim(const string& str) {
+    size_t first = str.find_first_not_of(" \t\r\n");  // find first non-whitespace character
+    if (first == string::npos)
+        return "";  // return empty string if no non-whitespace character found
+    size_t last = str.find_last_not_of(" \t\r\n");   // find last non-whitespace character
+    return str.substr(first, (last - first + 1));  // return the formatted string
+}
+
+// Non-owning view of one field: a pointer into the input buffer (or tokenizer scratch) and a length
+struct FieldView {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    string str() const { return string(data, size); }
+};
+
+// Function to tell whether a character is one of the whitespace characters trim removes
+inline bool isTrimmedSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Function to trim leading and trailing whitespaces by moving the ends of [first, last) inward
+inline FieldView trimView(const char* first, const char* last) {
+    while (first < last && isTrimmedSpace(*first)) ++first;
+    while (last > first && isTrimmedSpace(last[-1])) --last;
+    FieldView view;
+    view.data = first;
+    view.size = last - first;
+    return view;
+}
+
+// Class to split CSV records into FieldViews without allocating per record.
+// Plain and simply quoted fields point straight into the input; only fields with escaped
+// or stray quotes are rebuilt, into a scratch buffer that is reused from record to record.
+class CSVTokenizer {
+public:
+    explicit CSVTokenizer(char delimiter) : delimiter(delimiter) {}
+
+    // Splits the record in [first, last); the fields stay valid until the next call
+    size_t tokenize(const char* first, const char* last) {
+        fields.clear();
+        unescaped.clear();
+        if (unescaped.capacity() < static_cast<size_t>(last - first)) {
+            unescaped.reserve(last - first);  // rebuilt fields never outgrow the record, so views stay valid
+        }
+
+        StructuralScanner scanner(first, last, delimiter);
+        const char* fieldStart = first;
+        const char* firstQuote = nullptr;  // first and last quote of the current field
+        const char* lastQuote = nullptr;
+        size_t quotes = 0;
+        for (const char* p = scanner.next(first); p < last; p = scanner.next(p + 1)) {
+            if (*p == '"') {  // an escaped "" flips the state twice, so parity tracks inside_quotes
+                if (quotes++ == 0) firstQuote = p;
+                lastQuote = p;
+            } else if (quotes % 2 == 0) {  // delimiter outside quotes ends the field
+                fields.push_back(finishField(fieldStart, p, quotes, firstQuote, lastQuote));
+                fieldStart = p + 1;
+                quotes = 0;
+            }
+        }
+        fields.push_back(finishField(fieldStart, last, quotes, firstQuote, lastQuote));
+        return fields.size();
+    }
+
+    size_t size() const { return fields.size(); }
+    const FieldView& operator[](size_t i) const { return fields[i]; }
+
+private:
+    // Builds the trimmed, unquoted view of the field in [first, last)
+    FieldView finishField(const char* first, const char* last, size_t quotes, const char* firstQuote,
+                          const char* lastQuote) {
+        if (quotes == 0) {
+            return trimView(first, last);  // plain field: trimming just moves the offsets
+        }
+        FieldView raw = trimView(first, last);
+        if (quotes == 2 && firstQuote == raw.data && lastQuote == raw.data + raw.size - 1) {
+            return trimView(firstQuote + 1, lastQuote);  // "quoted" field: the text between the quotes
+        }
+
+        size_t start = unescaped.size();  // anything else is unescaped into the scratch buffer
+        bool inside_quotes = false;
+        for (const char* p = first; p < last; ++p) {
+            if (*p == '"') {
+                if (inside_quotes && p + 1 < last && p[1] == '"') {
+                    unescaped += '"';  // escaped quote inside quoted field
+                    ++p;
+                } else {
+                    inside_quotes = !inside_quotes;
+                }
+            } else {
+                unescaped += *p;
+            }
+        }
+        return trimView(unescaped.data() + start, unescaped.data() + unescaped.size());
+    }
+
+    char delimiter;            // field delimiter
+    vector<FieldView> fields;  // fields of the last record; keeps its capacity between records
+    string unescaped;          // storage for fields that had to be rebuilt
+};
+
+// Outcome of parsing a numeric field
+enum class NumberStatus { Ok, Empty, Invalid, OutOfRange };
+
+// Exact powers of ten representable in a double, used by the fast path of parseDecimal
+const double EXACT_POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Function to parse a whole field as a decimal number ([+-]digits[.digits][e[+-]digits]) without throwing.
+// Up to 19 significant digits are accumulated in an integer; when that mantissa and the power of ten are
+// both exact in a double a single multiply or divide gives the correctly rounded value, otherwise strtod does.
+NumberStatus parseDecimal(const char* first, const char* last, double& value) {
+    if (first == last) return NumberStatus::Empty;
+
+    const char* p = first;
+    bool negative = false;
+    if (*p == '+' || *p == '-') {
+        negative = *p == '-';
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int significant = 0;  // digits held in mantissa
+    int exponent = 0;     // power of ten to apply to mantissa
+    bool sawDigit = false;
+    for (; p < last && *p >= '0' && *p <= '9'; ++p) {
+        sawDigit = true;
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0) ++significant;  // leading zeros are not significant
+        } else {
+            ++exponent;  // digit beyond the mantissa's precision
+        }
+    }
+    if (p < last && *p == '.') {
+        for (++p; p < last && *p >= '0' && *p <= '9'; ++p) {
+            sawDigit = true;
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0) ++significant;
+                --exponent;
+            }
+        }
+    }
+    if (!sawDigit) return NumberStatus::Invalid;
+
+    if (p < last && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = false;
+        if (p < last && (*p == '+' || *p == '-')) {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        if (p == last || *p < '0' || *p > '9') return NumberStatus::Invalid;
+        int explicitExponent = 0;
+        for (; p < last && *p >= '0' && *p <= '9'; ++p) {
+            if (explicitExponent < 100000) explicitExponent = explicitExponent * 10 + (*p - '0');
+        }
+        exponent += negativeExponent ? -explicitExponent : explicitExponent;
+    }
+    if (p != last) return NumberStatus::Invalid;  // trailing characters
+
+    if (mantissa == 0) {
+        value = negative ? -0.0 : 0.0;
+        return NumberStatus::Ok;
+    }
+    if (mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+        value = static_cast<double>(mantissa);
+        value = exponent < 0 ? value / EXACT_POWERS_OF_TEN[-exponent] : value * EXACT_POWERS_OF_TEN[exponent];
+        if (negative) value = -value;
+        return NumberStatus::Ok;
+    }
+
+    // Rare slow path: the field is already validated, so strtod reads all of it
+    char local[128];
+    string copy;
+    const char* text = local;
+    size_t length = last - first;
+    if (length < sizeof(local)) {
+        memcpy(local, first, length);
+        local[length] = '\0';
+    } else {
+        copy.assign(first, last);
+        text = copy.c_str();
+    }
+    errno = 0;
+    value = strtod(text, nullptr);
+    if (errno == ERANGE && (value == HUGE_VAL || value == -HUGE_VAL)) return NumberStatus::OutOfRange;
+    return NumberStatus::Ok;
+}
+
+// Function to parse a delay field into whole minutes, truncating any fraction toward zero
+NumberStatus parseDelayMinutes(const FieldView& field, int& minutes) {
+    double value;
+    NumberStatus status = parseDecimal(field.data, field.data + field.size, value);
+    if (status != NumberStatus::Ok) return status;
+    if (!(value > -2147483649.0 && value < 2147483648.0)) return NumberStatus::OutOfRange;  // outside int
+    minutes = static_cast<int>(value);
+    return NumberStatus::Ok;
+}
+
+// Function to record a rejected numeric value in its column's tally
+void countRejected(NumberStatus status, NumericColumnStats& stats) {
+    switch (status) {
+        case NumberStatus::Empty: ++stats.empty; break;
+        case NumberStatus::Invalid: ++stats.invalid; break;
+        case NumberStatus::OutOfRange: ++stats.outOfRange; break;
+        case NumberStatus::Ok: break;
+    }
+}
+
+// Function to parse the CSV line in [first, last) into tokens separated by a delimiter
+vector<string> parseCSVLine(const char* first, const char* last, char delimiter) {
+    CSVTokenizer tokenizer(delimiter);
+    tokenizer.tokenize(first, last);
+    vector<string> item;  // vector to store the parsed item
+    for (size_t i = 0; i < tokenizer.size(); ++i) {
+        item.push_back(tokenizer[i].str());
+    }
+    return item;
+}
+
+// Function to find the end of the record starting at first: the next newline that is not inside quotes
+const char* findRecordEnd(const char* first, const char* last) {
+    bool inside_quotes = false;
+    return findUnquotedNewline(first, last, inside_quotes);
+}
+
+// Function to parse every record in [first, last), appending the valid flights and counting rejects in stats
+void parseFlightRecords(const char* first, const char* last, char delimiter, const ColumnIndices& columns,
+                        FlightTable& flights, IngestStats& stats) {
+    size_t maxIndex = max({columns.carrier, columns.airport_name, columns.arr_delay});
+    CSVTokenizer tokenizer(delimiter);  // one tokenizer per call, reused for every record
+    const char* cursor = first;
+
+    while (cursor < last) {  // read flight data records straight out of the file view
+        const char* lineEnd = findRecordEnd(cursor, last);
+        const char* lineStart = cursor;
+        cursor = lineEnd == last ? last : lineEnd + 1;
+
+        if (lineStart == lineEnd) continue;  // skip empty lines
+        ++stats.records;
+
+        if (tokenizer.tokenize(lineStart, lineEnd) <= maxIndex) {  // skip invalid lines
+            ++stats.shortRecords;
+            continue;
+        }
+
+        int delay;
+        NumberStatus status = parseDelayMinutes(tokenizer[columns.arr_delay], delay);
+        if (status != NumberStatus::Ok) {
+            countRejected(status, stats.arr_delay);  // skip lines with invalid delay values
+            continue;
+        }
+        const FieldView& carrier = tokenizer[columns.carrier];
+        const FieldView& airport = tokenizer[columns.airport_name];
+        int carrierId = flights.carriers.intern(carrier.data, carrier.size);  // store the carrier code
+        int airportId = flights.airports.intern(airport.data, airport.size);  // store the airport name
+        if (carrierId < 0 || airportId < 0) {
+            ++stats.dictionaryFull;
+            continue;
+        }
+        flights.append(static_cast<uint16_t>(carrierId), static_cast<uint16_t>(airportId), delay);  // add the flight
+        ++stats.accepted;
+    }
+}
+
+// Ids that the dictionary entries of one table were given in another table's dictionaries; -1 where the
+// destination dictionary was full
+struct DictionaryMap {
+    vector<int> carriers;
+    vector<int> airports;
+};
+
+// Function to intern the carrier and airport names of src into the dictionaries of dest
+DictionaryMap mergeDictionaries(FlightTable& dest, const FlightTable& src) {
+    DictionaryMap map;
+    map.carriers.resize(src.carriers.size());
+    map.airports.resize(src.airports.size());
+    for (size_t id = 0; id < src.carriers.size(); ++id) {
+        map.carriers[id] = dest.carriers.intern(src.carriers.name(id));
+    }
+    for (size_t id = 0; id < src.airports.size(); ++id) {
+        map.airports[id] = dest.airports.intern(src.airports.name(id));
+    }
+    return map;
+}
+
+// Function to count the rows of src whose carrier and airport both have an id under map
+size_t countMappedRows(const FlightTable& src, const DictionaryMap& map) {
+    bool complete = find(map.carriers.begin(), map.carriers.end(), -1) == map.carriers.end() &&
+                    find(map.airports.begin(), map.airports.end(), -1) == map.airports.end();
+    if (complete) return src.size();  // the usual case; rows only drop out when a dictionary overflowed
+    size_t rows = 0;
+    for (size_t i = 0; i < src.size(); ++i) {
+        if (map.carriers[src.carrier_id[i]] >= 0 && map.airports[src.airport_id[i]] >= 0) ++rows;
+    }
+    return rows;
+}
+
+// Function to copy the rows of src counted by countMappedRows into dest from row offset on, translating
+// their ids under map. Writes only that many rows, so the parts of one table can be copied in parallel.
+void copyMappedRows(FlightTable& dest, size_t offset, const FlightTable& src, const DictionaryMap& map) {
+    for (size_t i = 0; i < src.size(); ++i) {
+        int carrierId = map.carriers[src.carrier_id[i]];
+        int airportId = map.airports[src.airport_id[i]];
+        if (carrierId < 0 || airportId < 0) continue;
+        dest.arr_delay[offset] = src.arr_delay[i];
+        dest.carrier_id[offset] = static_cast<uint16_t>(carrierId);
+        dest.airport_id[offset] = static_cast<uint16_t>(airportId);
+        ++offset;
+    }
+}
+
+// Function to parse [first, last) on several threads, keeping the flights in file order.
+// The range is cut into equal byte slices; each slice then starts at the first newline that
+// lies outside quotes, which is decided from the number of quotes in all earlier slices.
+void parseFlightRecordsParallel(const char* first, const char* last, char delimiter, const ColumnIndices& columns,
+                                unsigned threads, FlightTable& flights, IngestStats& stats) {
+    size_t sliceSize = (last - first + threads - 1) / threads;
+    vector<const char*> sliceStart(threads + 1);
+    for (unsigned i = 0; i <= threads; ++i) {
+        sliceStart[i] = first + min<size_t>(i * sliceSize, last - first);
+    }
+
+    // Pass 1: count the quotes in every slice
+    vector<size_t> quoteCount(threads, 0);
+    runOnThreads(threads, [&](size_t i) {
+        quoteCount[i] = countQuotes(sliceStart[i], sliceStart[i + 1]);
+    });
+
+    // Pass 2: move each slice start forward to the first record boundary inside it
+    vector<const char*> recordStart(threads + 1, nullptr);
+    recordStart[0] = first;
+    recordStart[threads] = last;
+    vector<bool> quotedBefore(threads, false);  // quote state at the start of each slice
+    for (unsigned i = 1; i < threads; ++i) {
+        quotedBefore[i] = quotedBefore[i - 1] != (quoteCount[i - 1] % 2 == 1);
+    }
+    runOnThreads(threads, [&](size_t i) {
+        if (i == 0) return;
+        bool inside_quotes = quotedBefore[i];
+        if (sliceStart[i][-1] == '\n' && !inside_quotes) {  // the cut already falls on a record boundary
+            recordStart[i] = sliceStart[i];
+            return;
+        }
+        const char* newline = findUnquotedNewline(sliceStart[i], sliceStart[i + 1], inside_quotes);
+        if (newline != sliceStart[i + 1]) {
+            recordStart[i] = newline + 1;
+        }
+    });
+    for (unsigned i = threads - 1; i > 0; --i) {
+        if (recordStart[i] == nullptr) recordStart[i] = recordStart[i + 1];  // slice lies inside one long record
+    }
+
+    // Pass 3: parse every slice into its own table, then append them in file order. The slice dictionaries
+    // are merged serially, which fixes where each slice's rows go; the rows are then copied in parallel.
+    vector<FlightTable> parts(threads);
+    vector<IngestStats> partStats(threads);
+    runOnThreads(threads, [&](size_t i) {
+        parseFlightRecords(recordStart[i], recordStart[i + 1], delimiter, columns, parts[i], partStats[i]);
+    });
+    for (const auto& part : partStats) {
+        stats.add(part);
+    }
+
+    vector<DictionaryMap> maps(threads);
+    vector<size_t> offsets(threads + 1);
+    offsets[0] = flights.size();
+    for (unsigned i = 0; i < threads; ++i) {
+        maps[i] = mergeDictionaries(flights, parts[i]);
+        size_t rows = countMappedRows(parts[i], maps[i]);
+        stats.dictionaryFull += parts[i].size() - rows;  // only possible when the slices together overflow a dictionary
+        stats.accepted -= parts[i].size() - rows;
+        offsets[i + 1] = offsets[i] + rows;
+    }
+    flights.resize(offsets[threads]);
+    runOnThreads(threads, [&](size_t i) {
+        copyMappedRows(flights, offsets[i], parts[i], maps[i]);
+        parts[i] = FlightTable();  // release each slice as soon as it has been copied out
+    });
+}
+
+// Size and modification time of a file, used to tell whether a snapshot still matches its source
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtime = 0;  // seconds since the epoch
+};
+
+// Function to read the size and modification time of a file
+bool getFileStamp(const string& filename, FileStamp& stamp) {
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(filename.c_str(), &info) != 0) return false;
+#else
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) return false;
+#endif
+    stamp.size = static_cast<uint64_t>(info.st_size);
+    stamp.mtime = static_cast<int64_t>(info.st_mtime);
+    return true;
+}
+
+const char SNAPSHOT_MAGIC[8] = {'P', '3', 'S', 'N', 'A', 'P', '\0', '\0'};
+const uint32_t SNAPSHOT_VERSION = 3;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;  // read back differently on a machine of the other endianness
+
+// Fixed-size header at the start of a snapshot file; section offsets are bytes from the start of the file.
+// Each dictionary section is a uint32 count, count + 1 uint32 string offsets and the string bytes;
+// the columns are packed arrays with one entry per flight, each starting on an 8-byte boundary. The
+// optional delay partitions are the uint32 row ids of FlightTable::carrierRowsByDelay / airportRowsByDelay.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t sourceSize;          // FileStamp of the CSV the snapshot was built from
+    int64_t sourceMtime;
+    uint64_t rows;                // number of flights
+    uint64_t carrierDictionary;   // carrier code strings
+    uint64_t airportDictionary;   // airport name strings
+    uint64_t carrierColumn;       // uint16 carrier id per flight
+    uint64_t airportColumn;       // uint16 airport id per flight
+    uint64_t delayColumn;         // int32 arr_delay per flight
+    uint64_t fileSize;            // total size, to detect truncated files
+    uint64_t records;             // IngestStats of the parse that produced the snapshot
+    uint64_t shortRecords;
+    uint64_t emptyDelays;
+    uint64_t invalidDelays;
+    uint64_t outOfRangeDelays;
+    uint64_t dictionaryFull;
+    uint64_t carrierRowsByDelay;  // uint32 row id per flight; 0 when the partitions were not saved
+    uint64_t airportRowsByDelay;
+};
+
+// Function to pick the snapshot file that belongs to a CSV file
+string snapshotPathFor(const string& filename) {
+    return filename + ".snap";
+}
+
+// Function to write zero bytes until the stream position is a multiple of 8
+void padSnapshot(ofstream& out, uint64_t& offset) {
+    static const char zeros[8] = {};
+    size_t padding = (8 - offset % 8) % 8;
+    out.write(zeros, padding);
+    offset += padding;
+}
+
+// Function to write one dictionary section
+void writeSnapshotDictionary(ofstream& out, uint64_t& offset, const StringDictionary& names) {
+    uint32_t count = static_cast<uint32_t>(names.size());
+    vector<uint32_t> offsets(1, 0);
+    for (size_t id = 0; id < names.size(); ++id) {
+        offsets.push_back(offsets.back() + static_cast<uint32_t>(names.name(id).size()));
+    }
+    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint32_t));
+    for (size_t id = 0; id < names.size(); ++id) {
+        out.write(names.name(id).data(), names.name(id).size());
+    }
+    offset += sizeof(count) + offsets.size() * sizeof(uint32_t) + offsets.back();
+    padSnapshot(out, offset);
+}
+
+// Function to save flights as a columnar snapshot; writes to a temporary file and renames it into place
+bool writeSnapshot(const string& path, const FileStamp& source, const FlightTable& flights,
+                   const IngestStats& stats) {
+    string temporaryPath = path + ".tmp";
+    ofstream out(temporaryPath, ios::binary | ios::trunc);
+    if (!out.is_open()) {
+        cerr << "Failed to create snapshot: " << temporaryPath << endl;
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.sourceSize = source.size;
+    header.sourceMtime = source.mtime;
+    header.rows = flights.size();
+    header.records = stats.records;
+    header.shortRecords = stats.shortRecords;
+    header.emptyDelays = stats.arr_delay.empty;
+    header.invalidDelays = stats.arr_delay.invalid;
+    header.outOfRangeDelays = stats.arr_delay.outOfRange;
+    header.dictionaryFull = stats.dictionaryFull;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));  // rewritten below once offsets are known
+
+    uint64_t offset = sizeof(header);
+    header.carrierDictionary = offset;
+    writeSnapshotDictionary(out, offset, flights.carriers);
+    header.airportDictionary = offset;
+    writeSnapshotDictionary(out, offset, flights.airports);
+
+    header.carrierColumn = offset;
+    out.write(reinterpret_cast<const char*>(flights.carrier_id.data()), flights.size() * sizeof(uint16_t));
+    offset += flights.size() * sizeof(uint16_t);
+    padSnapshot(out, offset);
+    header.airportColumn = offset;
+    out.write(reinterpret_cast<const char*>(flights.airport_id.data()), flights.size() * sizeof(uint16_t));
+    offset += flights.size() * sizeof(uint16_t);
+    padSnapshot(out, offset);
+    header.delayColumn = offset;
+    out.write(reinterpret_cast<const char*>(flights.arr_delay.data()), flights.size() * sizeof(int32_t));
+    offset += flights.size() * sizeof(int32_t);
+    if (flights.delayPartitions) {
+        padSnapshot(out, offset);
+        header.carrierRowsByDelay = offset;
+        out.write(reinterpret_cast<const char*>(flights.carrierRowsByDelay.rowIds().data()), flights.size() * sizeof(uint32_t));
+        offset += flights.size() * sizeof(uint32_t);
+        header.airportRowsByDelay = offset;
+        out.write(reinterpret_cast<const char*>(flights.airportRowsByDelay.rowIds().data()), flights.size() * sizeof(uint32_t));
+        offset += flights.size() * sizeof(uint32_t);
+    }
+    header.fileSize = offset;
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+    if (!out) {
+        cerr << "Failed to write snapshot: " << temporaryPath << endl;
+        remove(temporaryPath.c_str());
+        return false;
+    }
+    remove(path.c_str());  // rename does not replace an existing file on Windows
+    if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        cerr << "Failed to move snapshot into place: " << path << endl;
+        remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Function to read one dictionary section, checking that it lies inside the snapshot
+bool readSnapshotDictionary(const MappedFile& file, uint64_t offset, StringDictionary& names) {
+    if (offset + sizeof(uint32_t) > file.size()) return false;
+    uint32_t count;
+    memcpy(&count, file.data() + offset, sizeof(count));
+    uint64_t offsetsStart = offset + sizeof(count);
+    uint64_t bytesStart = offsetsStart + (uint64_t(count) + 1) * sizeof(uint32_t);
+    if (bytesStart > file.size()) return false;
+
+    vector<uint32_t> offsets(count + 1);
+    memcpy(offsets.data(), file.data() + offsetsStart, offsets.size() * sizeof(uint32_t));
+    if (bytesStart + offsets.back() > file.size()) return false;
+
+    names = StringDictionary();
+    for (uint32_t i = 0; i < count; ++i) {
+        if (offsets[i] > offsets[i + 1]) return false;
+        if (names.intern(file.data() + bytesStart + offsets[i], offsets[i + 1] - offsets[i]) != static_cast<int>(i)) {
+            return false;  // duplicate or overflowing entry
+        }
+    }
+    return true;
+}
+
+// Function to check that the rows of every id of index are ordered by arr_delay, then by row
+bool isDelayOrdered(const FlightTable& flights, const RowIndex& index) {
+    for (size_t id = 0; id < index.ids(); ++id) {
+        for (const uint32_t* row = index.begin(id); row + 1 < index.end(id); ++row) {
+            int32_t delay = flights.arr_delay[row[0]], nextDelay = flights.arr_delay[row[1]];
+            if (delay > nextDelay || (delay == nextDelay && row[0] > row[1])) return false;
+        }
+    }
+    return true;
+}
+
+// Function to load flights from a snapshot if it exists and was built from the current version of the source.
+// Saved delay partitions are only read and checked when loadPartitions is set; otherwise they are skipped.
+bool loadSnapshot(const string& path, const FileStamp& source, bool loadPartitions, FlightTable& flights,
+                  IngestStats& stats) {
+    MappedFile file;
+    if (!file.open(path, true)) return false;  // no snapshot yet
+    if (file.size() < sizeof(SnapshotHeader)) return false;
+
+    SnapshotHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+        return false;  // another format; it is rebuilt from the CSV
+    }
+    if (header.sourceSize != source.size || header.sourceMtime != source.mtime) {
+        return false;  // the CSV changed since the snapshot was written
+    }
+    if (header.fileSize != file.size() || header.carrierColumn + header.rows * sizeof(uint16_t) > file.size() ||
+        header.airportColumn + header.rows * sizeof(uint16_t) > file.size() ||
+        header.delayColumn + header.rows * sizeof(int32_t) > file.size()) {
+        return false;  // truncated or damaged
+    }
+
+    FlightTable loaded;
+    if (!readSnapshotDictionary(file, header.carrierDictionary, loaded.carriers) ||
+        !readSnapshotDictionary(file, header.airportDictionary, loaded.airports)) {
+        return false;
+    }
+
+    // The columns are copied out of the mapping in bulk; only the ids need a range check
+    const uint16_t* carrierColumn = reinterpret_cast<const uint16_t*>(file.data() + header.carrierColumn);
+    const uint16_t* airportColumn = reinterpret_cast<const uint16_t*>(file.data() + header.airportColumn);
+    const int32_t* delayColumn = reinterpret_cast<const int32_t*>(file.data() + header.delayColumn);
+    loaded.carrier_id.assign(carrierColumn, carrierColumn + header.rows);
+    loaded.airport_id.assign(airportColumn, airportColumn + header.rows);
+    loaded.arr_delay.assign(delayColumn, delayColumn + header.rows);
+    uint16_t maxCarrier = 0, maxAirport = 0;
+    for (uint64_t i = 0; i < header.rows; ++i) {
+        maxCarrier = max(maxCarrier, loaded.carrier_id[i]);
+        maxAirport = max(maxAirport, loaded.airport_id[i]);
+    }
+    if (header.rows > 0 && (maxCarrier >= loaded.carriers.size() || maxAirport >= loaded.airports.size())) {
+        return false;  // id outside its dictionary
+    }
+
+    // The delay partitions are checked to group every row under its id, in arr_delay order
+    if (loadPartitions && header.carrierRowsByDelay != 0 && header.airportRowsByDelay != 0) {
+        if (header.carrierRowsByDelay + header.rows * sizeof(uint32_t) > file.size() ||
+            header.airportRowsByDelay + header.rows * sizeof(uint32_t) > file.size() ||
+            !loaded.carrierRowsByDelay.assign(loaded.carrier_id, loaded.carriers.size(),
+                                              reinterpret_cast<const uint32_t*>(file.data() + header.carrierRowsByDelay)) ||
+            !loaded.airportRowsByDelay.assign(loaded.airport_id, loaded.airports.size(),
+                                              reinterpret_cast<const uint32_t*>(file.data() + header.airportRowsByDelay)) ||
+            !isDelayOrdered(loaded, loaded.carrierRowsByDelay) || !isDelayOrdered(loaded, loaded.airportRowsByDelay)) {
+            return false;
+        }
+        loaded.delayPartitions = true;
+    }
+
+    flights = move(loaded);
+    stats = IngestStats();
+    stats.records = header.records;
+    stats.accepted = header.rows;
+    stats.shortRecords = header.shortRecords;
+    stats.arr_delay.empty = header.emptyDelays;
+    stats.arr_delay.invalid = header.invalidDelays;
+    stats.arr_delay.outOfRange = header.outOfRangeDelays;
+    stats.dictionaryFull = header.dictionaryFull;
+    return true;
+}
+
+// Function to parse flight data from a CSV file
+FlightTable parseFlightFile(const string& filename, const IngestOptions& options, IngestStats& stats) {
+    FlightTable flights;  // table to store the flight data
+    MappedFile file;  // whole-file view; lines are parsed in place without copying
+
+    if (!file.open(filename, options.useMemoryMap)) {  // check if the file is opened successfully
+        cerr << "Failed to open file: " << filename << endl;
+        return flights;  // return an empty table if file cannot be opened
+    }
+    if (options.useMemoryMap && !file.isMapped() && file.size() > 0) {
+        cout << "Could not memory-map " << filename << "; read it through a stream instead." << endl;
+    }
+
+    const char* cursor = file.data();
+    const char* end = file.data() + file.size();
+
+    if (cursor == end) {  // the header line must be present
+        cerr << "Failed to read header line from the file." << endl;
+        return flights;  // return an empty table if header cannot be read
+    }
+
+    const char* headerEnd = findRecordEnd(cursor, end);
+
+    char comma = detectDelimiter(cursor, headerEnd);  // tab if the header contains one, comma otherwise
+
+    vector<string> headers = parseCSVLine(cursor, headerEnd, comma);  // parse the header line into columns
+    cursor = headerEnd == end ? end : headerEnd + 1;
+
+    cout << "Headers:" << endl;
+    for (size_t i = 0; i < headers.size(); ++i) {  // output the headers for debugging
+        cout << i << ": '" << headers[i] << "'" << endl;
+    }
+
+    int carrier_idx = -1, airport_name_idx = -1, arr_delay_idx = -1;
+    // find the indices of the required columns based on header names
+    for (size_t i = 0; i < headers.size(); ++i) {
+        string header_lower = headers[i];
+        transform(header_lower.begin(), header_lower.end(), header_lower.begin(), ::tolower);  // convert to lowercase
+        header_lower = trim(header_lower);
+        if (header_lower == "carrier") carrier_idx = i;
+        else if (header_lower == "airport_name") airport_name_idx = i;
+        else if (header_lower == "arr_delay") arr_delay_idx = i;
+    }
+
+    cout << "carrier_idx: " << carrier_idx << ", airport_name_idx: " << airport_name_idx << ", arr_delay_idx: " << arr_delay_idx << endl;
+
+    // if any required column is missing, return an empty table
+    if (carrier_idx == -1 || airport_name_idx == -1 || arr_delay_idx == -1) {
+        cerr << "Required columns not found in the CSV file." << endl;
+        return flights;
+    }
+
+    ColumnIndices columns;
+    columns.carrier = carrier_idx;
+    columns.airport_name = airport_name_idx;
+    columns.arr_delay = arr_delay_idx;
+
+    unsigned threads = options.threads != 0 ? options.threads : max(1u, thread::hardware_concurrency());
+    size_t usefulThreads = max<size_t>(1, (end - cursor) / MIN_PARSE_CHUNK_BYTES);
+    if (threads > usefulThreads) threads = static_cast<unsigned>(usefulThreads);  // tiny files are not worth splitting
+
+    if (threads <= 1) {
+        parseFlightRecords(cursor, end, comma, columns, flights, stats);
+    } else {
+        parseFlightRecordsParallel(cursor, end, comma, columns, threads, flights, stats);
+    }
+
+    return flights;  // return the list of flights
+}
+
+void buildDelayPartitions(FlightTable& flights, unsigned threads);  // defined with the sort engines below
+
+// Function to read flight data from a CSV file, going through its snapshot when enabled
+FlightTable readFlightData(const string& filename, const IngestOptions& options = IngestOptions(),
+                           IngestStats* statsOut = nullptr) {
+    FlightTable flights;
+    IngestStats stats;
+    FileStamp stamp;
+    bool haveStamp = options.useSnapshot && getFileStamp(filename, stamp);
+    string snapshotPath = snapshotPathFor(filename);
+
+    bool saveSnapshot = false;
+    if (haveStamp && loadSnapshot(snapshotPath, stamp, options.presort, flights, stats)) {
+        cout << "Loaded snapshot: " << snapshotPath << endl;
+    } else {
+        flights = parseFlightFile(filename, options, stats);
+        saveSnapshot = haveStamp && !flights.empty();
+    }
+    flights.buildIndexes();
+
+    if (options.presort && !flights.delayPartitions) {
+        auto start = high_resolution_clock::now();
+        buildDelayPartitions(flights, options.threads);
+        auto end = high_resolution_clock::now();
+        cout << "Delay partitions built in " << duration<double, milli>(end - start).count() << " ms" << endl;
+        saveSnapshot = saveSnapshot || (haveStamp && !flights.empty());  // add them to the loaded snapshot
+    }
+    if (saveSnapshot && writeSnapshot(snapshotPath, stamp, flights, stats)) {
+        cout << "Saved snapshot: " << snapshotPath << endl;
+    }
+
+    cout << "Records: " << stats.records << ", loaded: " << stats.accepted << ", short records: " << stats.shortRecords
+         << ", dictionary full: " << stats.dictionaryFull << ", arr_delay empty/invalid/out of range: " << stats.arr_delay.empty << "/" << stats.arr_delay.invalid
+         << "/" << stats.arr_delay.outOfRange << endl;
+    if (statsOut != nullptr) *statsOut = stats;
+    return flights;
+}
+
+// Packed sort keys hold the arrival delay in the high 32 bits (sign bit flipped so unsigned order matches
+// signed order) and the FlightTable row id in the low 32 bits. Sorting keys compares one integer per element,
+// moves 8 bytes per swap, and breaks delay ties by row id, i.e. by file order.
+inline uint64_t packSortKey(int32_t delay, uint32_t row) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(delay) ^ 0x80000000u) << 32) | row;
+}
+
+inline int32_t sortKeyDelay(uint64_t key) {
+    return static_cast<int32_t>(static_cast<uint32_t>(key >> 32) ^ 0x80000000u);
+}
+
+inline uint32_t sortKeyRow(uint64_t key) {
+    return static_cast<uint32_t>(key);
+}
+
+// Sort orders are policies passed to the sorting engines as a template argument. An order's static key()
+// maps a Flight to an unsigned integer whose ascending order is the sort order, so every comparison is one
+// inlined integer compare. String columns order by dictionary id, which groups equal names together.
+struct ArrivalDelayOrder {
+    static uint32_t key(const Flight& flight) {
+        return static_cast<uint32_t>(flight.arr_delay) ^ 0x80000000u;  // flip the sign bit: unsigned order matches signed
+    }
+};
+
+struct CarrierOrder {
+    static uint16_t key(const Flight& flight) { return flight.carrier_id; }
+};
+
+struct AirportOrder {
+    static uint16_t key(const Flight& flight) { return flight.airport_id; }
+};
+
+// Order policy reversing another order
+template <typename Order>
+struct Descending {
+    typedef decltype(Order::key(Flight())) Key;
+    static Key key(const Flight& flight) { return static_cast<Key>(~Order::key(flight)); }
+};
+
+// Order policy comparing by Major first and by Minor among ties, as one key with Major in the high bits
+template <typename Major, typename Minor>
+struct ThenBy {
+    typedef decltype(Major::key(Flight())) MajorKey;
+    typedef decltype(Minor::key(Flight())) MinorKey;
+    static_assert(sizeof(MajorKey) + sizeof(MinorKey) <= sizeof(uint64_t), "composite key must fit in 64 bits");
+    typedef typename conditional<sizeof(MajorKey) + sizeof(MinorKey) <= sizeof(uint32_t), uint32_t, uint64_t>::type Key;
+    static Key key(const Flight& flight) {
+        return static_cast<Key>(static_cast<Key>(Major::key(flight)) << (8 * sizeof(MinorKey))) | Minor::key(flight);
+    }
+};
+
+// Carrier, then airport, then arrival delay
+typedef ThenBy<ThenBy<CarrierOrder, AirportOrder>, ArrivalDelayOrder> CarrierAirportDelayOrder;
+
+// Function to return the key a record is sorted by under Order: the order's key of a Flight, or a packed
+// sort key itself (it was packed from the same order's key, see buildSortKeys)
+template <typename Order>
+inline auto orderKey(const Flight& flight) -> decltype(Order::key(flight)) { return Order::key(flight); }
+template <typename Order>
+inline uint64_t orderKey(uint64_t key) { return key; }
+
+// Function to return the flight a sorted element stands for, reading the table only for packed keys
+inline Flight recordFlight(const FlightTable&, const Flight& flight) { return flight; }
+inline Flight recordFlight(const FlightTable& flights, uint64_t key) { return flights.row(sortKeyRow(key)); }
+
+// Function to copy the selected rows out of the table as Flight records
+vector<Flight> gatherFlights(const FlightTable& flights, const vector<uint32_t>& rows) {
+    vector<Flight> records;
+    records.reserve(rows.size());
+    for (uint32_t row : rows) {
+        records.push_back(flights.row(row));
+    }
+    return records;
+}
+
+// Function to pack the selected rows into (order key, row id) sort keys; the order's key must fit in 32 bits.
+// Under the default order these are the (arr_delay, row id) keys of packSortKey.
+template <typename Order = ArrivalDelayOrder>
+vector<uint64_t> buildSortKeys(const FlightTable& flights, const vector<uint32_t>& rows) {
+    vector<uint64_t> keys;
+    keys.reserve(rows.size());
+    for (uint32_t row : rows) {
+        keys.push_back((static_cast<uint64_t>(Order::key(flights.row(row))) << 32) | row);
+    }
+    return keys;
+}
+
+// LSD radix sort on the order's unsigned key, one byte per pass from least to most significant.
+// All byte histograms are counted in one pass, and a pass whose histogram puts every record
+// in one bucket is skipped. Records move between the input and a single scratch buffer.
+template <typename Order = ArrivalDelayOrder, typename Record>
+void radixSort(vector<Record>& flights, int left, int right) {
+    if (left >= right) return;
+    typedef decltype(orderKey<Order>(flights[left])) Key;
+    const int passes = sizeof(Key);
+    size_t n = right - left + 1;
+
+    vector<size_t> counts(passes * 256, 0);  // histogram of every byte position
+    for (int i = left; i <= right; ++i) {
+        Key key = orderKey<Order>(flights[i]);
+        for (int pass = 0; pass < passes; ++pass) {
+            ++counts[pass * 256 + ((key >> (pass * 8)) & 0xFF)];
+        }
+    }
+
+    vector<Record> scratch(n);
+    Record* source = &flights[left];
+    Record* target = scratch.data();
+    for (int pass = 0; pass < passes; ++pass) {
+        size_t* bucket = &counts[pass * 256];
+        int shift = pass * 8;
+        if (bucket[(orderKey<Order>(source[0]) >> shift) & 0xFF] == n) {
+            continue;  // every record has the same byte here, so this pass would not move anything
+        }
+
+        size_t offset = 0;  // turn the counts into starting positions
+        for (int digit = 0; digit < 256; ++digit) {
+            size_t count = bucket[digit];
+            bucket[digit] = offset;
+            offset += count;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            target[bucket[(orderKey<Order>(source[i]) >> shift) & 0xFF]++] = source[i];  // stable scatter
+        }
+        swap(source, target);
+    }
+
+    if (source != &flights[left]) {
+        copy(source, source + n, flights.begin() + left);  // an odd number of passes ends in the scratch buffer
+    }
+}
+
+// Counting sort is used while the key range is at most this many times the number of records
+const uint64_t COUNTING_SORT_RANGE_FACTOR = 4;
+
+// Function to return the key a record is counted by: the order's key of a Flight, or the high half of a
+// packed key (the order's key without the row id)
+template <typename Order>
+inline uint64_t histogramKey(const Flight& flight) { return Order::key(flight); }
+template <typename Order>
+inline uint64_t histogramKey(uint64_t key) { return key >> 32; }
+
+// Function to put the records that share a key back in order after the counting scatter. Flight records
+// only compare by key, so the stable scatter already did it; packed keys also order ties by row id, so
+// every bucket whose row ids are not ascending yet is radix sorted on its own.
+template <typename Order>
+inline void orderCountingTies(vector<Flight>&, int, const vector<size_t>&) {}
+template <typename Order>
+inline void orderCountingTies(vector<uint64_t>& keys, int left, const vector<size_t>& bucketEnds) {
+    size_t begin = 0;
+    for (size_t end : bucketEnds) {
+        if (end - begin > 1 && !is_sorted(keys.begin() + left + begin, keys.begin() + left + end)) {
+            radixSort<Order>(keys, left + static_cast<int>(begin), left + static_cast<int>(end) - 1);
+        }
+        begin = end;
+    }
+}
+
+// Counting (histogram) sort on the order's key. One pass finds the smallest and largest key; if that
+// range is small compared to the number of records, a second pass counts every key and a third
+// scatters the records stably into their buckets. Wider ranges fall back to the LSD radix sort.
+template <typename Order = ArrivalDelayOrder, typename Record>
+void countingSort(vector<Record>& flights, int left, int right) {
+    if (left >= right) return;
+    size_t n = right - left + 1;
+    uint64_t lowest = histogramKey<Order>(flights[left]), highest = lowest;
+    for (int i = left + 1; i <= right; ++i) {
+        uint64_t key = histogramKey<Order>(flights[i]);
+        lowest = min(lowest, key);
+        highest = max(highest, key);
+    }
+    if (highest - lowest >= COUNTING_SORT_RANGE_FACTOR * n) {
+        radixSort<Order>(flights, left, right);  // too sparse: the histogram would cost more than the records
+        return;
+    }
+
+    vector<size_t> bucketEnds(highest - lowest + 1, 0);  // counts, then the start of each bucket, then its end
+    for (int i = left; i <= right; ++i) {
+        ++bucketEnds[histogramKey<Order>(flights[i]) - lowest];
+    }
+    size_t offset = 0;
+    for (size_t& bucket : bucketEnds) {
+        size_t count = bucket;
+        bucket = offset;
+        offset += count;
+    }
+    vector<Record> scratch(n);
+    for (int i = left; i <= right; ++i) {
+        scratch[bucketEnds[histogramKey<Order>(flights[i]) - lowest]++] = flights[i];  // stable scatter
+    }
+    copy(scratch.begin(), scratch.end(), flights.begin() + left);
+    orderCountingTies<Order>(flights, left, bucketEnds);
+}
+
+// Function to order the rows of every carrier and every airport by arr_delay, ties in row order, so a
+// filtered sorted query is a slice of FlightTable::carrierRowsByDelay or airportRowsByDelay. Each partition
+// is counting sorted as (arr_delay, row id) keys; the threads (0 uses every hardware thread) take the
+// partitions largest first from a shared counter.
+void buildDelayPartitions(FlightTable& flights, unsigned threads) {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    flights.carrierRowsByDelay = flights.carrierRows;
+    flights.airportRowsByDelay = flights.airportRows;
+
+    vector<pair<RowIndex*, size_t>> partitions;  // (index, id) of every non-empty partition
+    for (RowIndex* index : {&flights.carrierRowsByDelay, &flights.airportRowsByDelay}) {
+        for (size_t id = 0; id < index->ids(); ++id) {
+            if (index->count(id) > 1) partitions.push_back(make_pair(index, id));
+        }
+    }
+    sort(partitions.begin(), partitions.end(), [](const pair<RowIndex*, size_t>& a, const pair<RowIndex*, size_t>& b) {
+        return a.first->count(a.second) > b.first->count(b.second);
+    });
+
+    atomic<size_t> nextPartition(0);
+    runOnThreads(min<size_t>(threads, partitions.size()), [&](size_t) {
+        vector<uint64_t> keys;
+        for (size_t i = nextPartition++; i < partitions.size(); i = nextPartition++) {
+            uint32_t* first = partitions[i].first->begin(partitions[i].second);
+            uint32_t* last = partitions[i].first->end(partitions[i].second);
+            keys.clear();
+            for (uint32_t* row = first; row != last; ++row) {
+                keys.push_back(packSortKey(flights.arr_delay[*row], *row));
+            }
+            countingSort(keys, 0, static_cast<int>(keys.size()) - 1);
+            for (size_t j = 0; j < keys.size(); ++j) {
+                first[j] = sortKeyRow(keys[j]);
+            }
+        }
+    });
+    flights.delayPartitions = true;
+}
+
+// Class to run fork-join tasks on a fixed set of worker threads. Each worker owns a deque: it pushes
+// and pops its own tasks at the back (newest, smallest ranges first) and, when it runs dry, steals
+// from the front of another worker's deque, where the oldest and largest ranges wait.
+class WorkStealingPool {
+public:
+    typedef function<void(unsigned)> Task;  // receives the index of the worker running it
+
+    explicit WorkStealingPool(unsigned threads) : queues(max(1u, threads)) {}
+
+    unsigned size() const { return static_cast<unsigned>(queues.size()); }
+
+    // Queues a task on a worker's own deque
+    void spawn(unsigned worker, Task task) {
+        pending.fetch_add(1);
+        lock_guard<mutex> lock(queues[worker].lock);
+        queues[worker].tasks.push_back(move(task));
+    }
+
+    // Runs body(i) for every i in [0, count) from a task running on worker and returns once all are done.
+    // Helper tasks on this worker's deque let idle workers claim indices; the worker claims them too, so
+    // no thread is started and nothing waits on an index nobody took.
+    template <typename Body>
+    void parallelFor(unsigned worker, size_t count, const Body& body) {
+        struct Progress {
+            atomic<size_t> next{0};  // next unclaimed index
+            atomic<size_t> done{0};  // indices finished
+        };
+        shared_ptr<Progress> progress = make_shared<Progress>();  // outlives this call for late helpers
+        const Body* work = &body;  // only used while some index is unfinished, i.e. before this call returns
+        auto claimAll = [progress, work, count]() {
+            for (size_t i = progress->next++; i < count; i = progress->next++) {
+                (*work)(i);
+                progress->done.fetch_add(1);
+            }
+        };
+        for (size_t helper = 1; helper < min<size_t>(count, size()); ++helper) {
+            spawn(worker, [claimAll](unsigned) { claimAll(); });
+        }
+        claimAll();
+        while (progress->done.load() != count) {
+            this_thread::yield();  // another worker is finishing the last claimed index
+        }
+    }
+
+    // Runs root and every task it spawns, using the calling thread as worker 0
+    void run(Task root) {
+        spawn(0, move(root));
+        runOnThreads(queues.size(), [this](size_t worker) { workLoop(static_cast<unsigned>(worker)); });
+    }
+
+private:
+    struct WorkQueue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    bool popOwn(unsigned worker, Task& task) {
+        lock_guard<mutex> lock(queues[worker].lock);
+        if (queues[worker].tasks.empty()) return false;
+        task = move(queues[worker].tasks.back());
+        queues[worker].tasks.pop_back();
+        return true;
+    }
+
+    bool steal(unsigned thief, Task& task) {
+        for (size_t k = 1; k < queues.size(); ++k) {
+            WorkQueue& victim = queues[(thief + k) % queues.size()];
+            lock_guard<mutex> lock(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Keeps running tasks until none is queued or running anywhere
+    void workLoop(unsigned worker) {
+        Task task;
+        while (pending.load() != 0) {
+            if (popOwn(worker, task) || steal(worker, task)) {
+                task(worker);
+                task = nullptr;
+                pending.fetch_sub(1);  // only now, so tasks it spawned are counted before it finishes
+            } else {
+                this_thread::yield();
+            }
+        }
+    }
+
+    vector<WorkQueue> queues;    // one deque per worker
+    atomic<size_t> pending{0};   // tasks queued or running
+};
+
+// Ranges up to this size are not split into parallel tasks
+const int PARALLEL_SORT_CUTOFF = 1 << 13;
+// Ranges at least this large are partitioned by several threads at once
+const int PARALLEL_PARTITION_CUTOFF = 1 << 17;
+
+// Ranges of packed keys up to this size are sorted by a sorting network
+const int SORTING_NETWORK_CUTOFF = 64;
+// Ranges of flight records up to this size are insertion sorted
+const int INSERTION_SORT_CUTOFF = 16;
+
+#if defined(__AVX2__)
+// Function to compare-exchange four signed 64-bit lanes: low gets the lane minimums, high the maximums
+inline void compareExchangeLanes(__m256i a, __m256i b, __m256i& low, __m256i& high) {
+    __m256i greater = _mm256_cmpgt_epi64(a, b);
+    low = _mm256_blendv_epi8(a, b, greater);
+    high = _mm256_blendv_epi8(b, a, greater);
+}
+#endif
+
+// Function to sort keys[0, Size) in place with a bitonic sorting network; Size is 8, 16, 32 or 64 and
+// a template argument so every stage unrolls. With AVX2 the keys sit four to a register: steps of 4 or
+// more compare whole registers, and steps of 1 and 2 compare each register with a lane-permuted copy
+// of itself and blend the minimums and maximums back by lane.
+template <size_t Size>
+inline void bitonicSortKeys(uint64_t* keys) {
+#if defined(__AVX2__)
+    const __m256i bias = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ULL));  // unsigned -> signed order
+    const __m256i upperHalf = _mm256_set_epi64x(-1, -1, 0, 0);    // lanes 2 and 3
+    const __m256i oddLanes = _mm256_set_epi64x(-1, 0, -1, 0);     // lanes 1 and 3
+    const __m256i middleLanes = _mm256_set_epi64x(0, -1, -1, 0);  // lanes 1 and 2
+    const size_t registers = Size / 4;
+    __m256i lanes[registers];
+    for (size_t r = 0; r < registers; ++r) {
+        lanes[r] = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + 4 * r)), bias);
+    }
+    for (size_t k = 2; k <= Size; k <<= 1) {
+        for (size_t j = k >> 1; j > 0; j >>= 1) {
+            for (size_t r = 0; r < registers; ++r) {
+                __m256i low, high;
+                if (j >= 4) {
+                    size_t step = j / 4;
+                    if (r & step) continue;
+                    compareExchangeLanes(lanes[r], lanes[r | step], low, high);
+                    bool ascending = ((4 * r) & k) == 0;
+                    lanes[r] = ascending ? low : high;
+                    lanes[r | step] = ascending ? high : low;
+                    continue;
+                }
+                __m256i partner = j == 2 ? _mm256_permute4x64_epi64(lanes[r], 0x4E)  // swap 128-bit halves
+                                         : _mm256_shuffle_epi32(lanes[r], 0x4E);     // swap neighbouring keys
+                compareExchangeLanes(lanes[r], partner, low, high);
+                if (k == 2) {
+                    lanes[r] = _mm256_blendv_epi8(low, high, middleLanes);  // pairs alternate direction in-register
+                } else {
+                    __m256i upper = j == 2 ? upperHalf : oddLanes;  // lanes holding the second key of each pair
+                    bool ascending = ((4 * r) & k) == 0;
+                    lanes[r] = ascending ? _mm256_blendv_epi8(low, high, upper) : _mm256_blendv_epi8(high, low, upper);
+                }
+            }
+        }
+    }
+    for (size_t r = 0; r < registers; ++r) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(keys + 4 * r), _mm256_xor_si256(lanes[r], bias));
+    }
+#else
+    // Scalar fallback: the same merges in the form where every pair is ascending. The first step of each
+    // merge compares mirrored positions instead of reversing half of the block, so min and max always go
+    // to the lower and upper index.
+    for (size_t k = 2; k <= Size; k <<= 1) {
+        for (size_t j = k >> 1; j > 0; j >>= 1) {
+            for (size_t block = 0; block < Size; block += 2 * j) {
+                for (size_t t = 0; t < j; ++t) {
+                    uint64_t& first = keys[block + t];
+                    uint64_t& second = keys[j == k >> 1 ? block + 2 * j - 1 - t : block + j + t];
+                    uint64_t a = first, b = second;
+                    bool swapped = b < a;
+                    first = swapped ? b : a;
+                    second = swapped ? a : b;
+                }
+            }
+        }
+    }
+#endif
+}
+
+// Function to pad keys[0, n) with all-ones keys to the next network size (8 to 64) and sort them
+inline void bitonicSortPadded(uint64_t* keys, size_t n) {
+    size_t size = 8;
+    while (size < n) size <<= 1;
+    fill(keys + n, keys + size, ~uint64_t(0));  // padding sorts to the end
+    switch (size) {
+        case 8: bitonicSortKeys<8>(keys); break;
+        case 16: bitonicSortKeys<16>(keys); break;
+        case 32: bitonicSortKeys<32>(keys); break;
+        default: bitonicSortKeys<64>(keys); break;
+    }
+}
+
+// Function to sort up to SORTING_NETWORK_CUTOFF packed keys with a sorting network. The keys are unique
+// (the row id is part of them), so the network's lack of stability does not matter.
+template <typename Order>
+inline void sortingNetworkSort(uint64_t* keys, size_t n) {
+    if (n < 2) return;
+    uint64_t padded[SORTING_NETWORK_CUTOFF];
+    copy(keys, keys + n, padded);
+    bitonicSortPadded(padded, n);
+    copy(padded, padded + n, keys);
+}
+
+// Function to stably insertion sort n records
+template <typename Order, typename Record>
+inline void insertionSort(Record* flights, size_t n) {
+    for (size_t i = 1; i < n; ++i) {
+        Record current = flights[i];
+        auto key = orderKey<Order>(current);
+        size_t j = i;
+        while (j > 0 && key < orderKey<Order>(flights[j - 1])) {
+            flights[j] = flights[j - 1];
+            --j;
+        }
+        flights[j] = current;
+    }
+}
+
+// Functions to finish a short range at the end of quicksort, introselect and merge sort's first pass.
+// Packed keys go through the sorting network. Flight records are insertion sorted: gathering them back
+// after a network over key+index pairs cost more than the network saved.
+template <typename Order>
+inline void smallSort(uint64_t* keys, size_t n) { sortingNetworkSort<Order>(keys, n); }
+template <typename Order>
+inline void smallSort(Flight* flights, size_t n) { insertionSort<Order>(flights, n); }
+
+// Functions to return the largest range smallSort finishes for each record type
+inline int smallSortCutoff(const uint64_t*) { return SORTING_NETWORK_CUTOFF; }
+inline int smallSortCutoff(const Flight*) { return INSERTION_SORT_CUTOFF; }
+
+// Function to return the median of three keys
+template <typename Key>
+Key medianOf3(Key a, Key b, Key c) {
+    return max(min(a, b), min(max(a, b), c));
+}
+
+// Function to partition [low, high] into keys < pivot, == pivot and > pivot (Dutch national flag).
+// Returns the first and last index of the == block, which is never empty when pivot comes from the range.
+template <typename Order, typename Record, typename Key>
+pair<int, int> threeWayPartition(vector<Record>& flights, int low, int high, Key pivot) {
+    int lt = low, i = low, gt = high;
+    while (i <= gt) {
+        Key key = orderKey<Order>(flights[i]);
+        if (key < pivot) {
+            swap(flights[lt++], flights[i++]);
+        } else if (key > pivot) {
+            swap(flights[i], flights[gt--]);
+        } else {
+            ++i;
+        }
+    }
+    return make_pair(lt, gt);
+}
+
+// Function to three-way partition a large range in blocks, from a task running on worker of pool. Each
+// block's <, == and > keys are counted, the counts give every block its place in the three output
+// regions, and the blocks are scattered into scratch and copied back; every step runs the blocks on
+// the pool's workers. Scratch holds the records from index scratchLow of flights on.
+template <typename Order, typename Record, typename Key>
+pair<int, int> parallelThreeWayPartition(WorkStealingPool& pool, unsigned worker, vector<Record>& flights, int low,
+                                         int high, Key pivot, unsigned threads, vector<Record>& scratch,
+                                         int scratchLow) {
+    size_t n = high - low + 1;
+    size_t blockSize = (n + threads - 1) / threads;
+    vector<size_t> lessCount(threads, 0), equalCount(threads, 0), greaterCount(threads, 0);
+    auto blockBegin = [&](size_t block) { return low + min(n, block * blockSize); };
+
+    pool.parallelFor(worker, threads, [&](size_t block) {
+        for (size_t i = blockBegin(block); i < blockBegin(block + 1); ++i) {
+            Key key = orderKey<Order>(flights[i]);
+            if (key < pivot) ++lessCount[block];
+            else if (key > pivot) ++greaterCount[block];
+            else ++equalCount[block];
+        }
+    });
+
+    size_t totalLess = 0, totalEqual = 0;
+    for (unsigned block = 0; block < threads; ++block) {
+        totalLess += lessCount[block];
+        totalEqual += equalCount[block];
+    }
+    vector<size_t> lessAt(threads), equalAt(threads), greaterAt(threads);  // output position of each block
+    size_t less = low, equal = low + totalLess, greater = low + totalLess + totalEqual;
+    for (unsigned block = 0; block < threads; ++block) {
+        lessAt[block] = less;
+        equalAt[block] = equal;
+        greaterAt[block] = greater;
+        less += lessCount[block];
+        equal += equalCount[block];
+        greater += greaterCount[block];
+    }
+
+    pool.parallelFor(worker, threads, [&](size_t block) {
+        size_t lessOut = lessAt[block], equalOut = equalAt[block], greaterOut = greaterAt[block];
+        for (size_t i = blockBegin(block); i < blockBegin(block + 1); ++i) {
+            Key key = orderKey<Order>(flights[i]);
+            if (key < pivot) scratch[lessOut++ - scratchLow] = flights[i];
+            else if (key > pivot) scratch[greaterOut++ - scratchLow] = flights[i];
+            else scratch[equalOut++ - scratchLow] = flights[i];
+        }
+    });
+    pool.parallelFor(worker, threads, [&](size_t block) {
+        copy(scratch.begin() + (blockBegin(block) - scratchLow), scratch.begin() + (blockBegin(block + 1) - scratchLow),
+             flights.begin() + blockBegin(block));
+    });
+
+    return make_pair(static_cast<int>(low + totalLess), static_cast<int>(low + totalLess + totalEqual - 1));
+}
+
+// Small xorshift64* generator used to sample pivots; cheap, and seeded so every run sorts the same way
+class PivotRandom {
+public:
+    explicit PivotRandom(uint64_t seed) : state(seed != 0 ? seed : 0x9E3779B97F4A7C15ULL) {}
+
+    // Returns the next pseudo-random 64-bit value
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    // Returns a pseudo-random index in [low, high]
+    int between(int low, int high) {
+        return low + static_cast<int>((next() >> 32) % static_cast<uint64_t>(high - low + 1));
+    }
+
+private:
+    uint64_t state;
+};
+
+// Seed for the quickSort pivot generator
+const uint64_t QUICK_SORT_SEED = 0x5DEECE66DULL;
+
+// Function to pick a pivot from random samples of [low, high]: the median of three samples, or for
+// larger ranges the ninther (the median of three medians of three)
+template <typename Order, typename Record>
+auto randomPivotKey(const vector<Record>& flights, int low, int high, PivotRandom& random)
+    -> decltype(orderKey<Order>(flights[low])) {
+    auto sample = [&]() { return orderKey<Order>(flights[random.between(low, high)]); };
+    if (high - low + 1 < 128) {
+        auto a = sample(), b = sample(), c = sample();
+        return medianOf3(a, b, c);
+    }
+    auto a1 = sample(), b1 = sample(), c1 = sample();
+    auto a2 = sample(), b2 = sample(), c2 = sample();
+    auto a3 = sample(), b3 = sample(), c3 = sample();
+    return medianOf3(medianOf3(a1, b1, c1), medianOf3(a2, b2, c2), medianOf3(a3, b3, c3));
+}
+
+// Function to heapsort [low, high]; the fallback once quickSort has recursed too deep
+template <typename Order, typename Record>
+void heapSort(vector<Record>& flights, int low, int high) {
+    int n = high - low + 1;
+    auto siftDown = [&](int root, int size) {
+        Record value = flights[low + root];
+        auto key = orderKey<Order>(value);
+        for (int child = 2 * root + 1; child < size; child = 2 * root + 1) {
+            if (child + 1 < size && orderKey<Order>(flights[low + child]) < orderKey<Order>(flights[low + child + 1])) ++child;
+            if (!(key < orderKey<Order>(flights[low + child]))) break;
+            flights[low + root] = flights[low + child];
+            root = child;
+        }
+        flights[low + root] = value;
+    };
+    for (int root = n / 2 - 1; root >= 0; --root) {
+        siftDown(root, n);  // build a max-heap
+    }
+    for (int size = n - 1; size > 0; --size) {
+        swap(flights[low], flights[low + size]);  // move the largest remaining key to the end
+        siftDown(0, size);
+    }
+}
+
+// Function to run the introsort loop on [low, high]: three-way partitions around sampled pivots, recursion
+// into the smaller side only, heapsort once depthLimit partitions deep, and smallSort for short ranges
+template <typename Order, typename Record>
+void introSort(vector<Record>& flights, int low, int high, int depthLimit, PivotRandom& random) {
+    while (high - low + 1 > smallSortCutoff(flights.data())) {
+        if (depthLimit-- == 0) {
+            heapSort<Order>(flights, low, high);  // pivots keep going wrong; heapsort bounds the rest to O(n log n)
+            return;
+        }
+        // runs of equal delays (zeros above all) land in the middle block and are never touched again
+        pair<int, int> equal = threeWayPartition<Order>(flights, low, high, randomPivotKey<Order>(flights, low, high, random));
+        if (equal.first - low < high - equal.second) {
+            introSort<Order>(flights, low, equal.first - 1, depthLimit, random);
+            low = equal.second + 1;
+        } else {
+            introSort<Order>(flights, equal.second + 1, high, depthLimit, random);
+            high = equal.first - 1;
+        }
+    }
+    if (low < high) smallSort<Order>(&flights[low], high - low + 1);
+}
+
+// QuickSort function to sort flight records or packed keys based on their arrival delay.
+// Introsort: three-way partitioning around sampled pivots, a small-range cutoff and a
+// heapsort fallback after 2*log2(n) levels, so neither duplicates nor bad inputs make it
+// quadratic or blow the stack.
+template <typename Order = ArrivalDelayOrder, typename Record>
+void quickSort(vector<Record>& flights, int low, int high) {
+    if (low >= high) return;
+    int depthLimit = 0;
+    for (int n = high - low + 1; n > 1; n >>= 1) {
+        depthLimit += 2;
+    }
+    PivotRandom random(QUICK_SORT_SEED);
+    introSort<Order>(flights, low, high, depthLimit, random);
+}
+
+// Function to sort [low, high] as one task of the parallel quicksort: while the range is large it is
+// partitioned around a sampled pivot (by several pool workers near the top of the tree), the left side is
+// pushed on this worker's deque for any idle worker to steal, and the task carries on with the right side.
+// Each task draws pivots from its own generator, seeded by the task that spawned it. Once depth reaches
+// depthLimit the rest of the range goes to quickSort, whose heapsort fallback bounds it to O(n log n).
+template <typename Order, typename Record>
+void parallelQuickSortTask(WorkStealingPool& pool, unsigned worker, vector<Record>& flights, int low, int high,
+                           int depth, int depthLimit, uint64_t seed, vector<Record>& scratch, int scratchLow) {
+    PivotRandom random(seed);
+    while (high - low + 1 > PARALLEL_SORT_CUTOFF && depth < depthLimit) {
+        auto pivot = randomPivotKey<Order>(flights, low, high, random);
+        unsigned partitionThreads = depth < 31 ? pool.size() >> depth : 0;  // top levels share the cores
+        pair<int, int> equal = high - low + 1 >= PARALLEL_PARTITION_CUTOFF && partitionThreads > 1
+                                   ? parallelThreeWayPartition<Order>(pool, worker, flights, low, high, pivot,
+                                                                      partitionThreads, scratch, scratchLow)
+                                   : threeWayPartition<Order>(flights, low, high, pivot);
+        ++depth;
+        int leftLow = low, leftHigh = equal.first - 1;
+        uint64_t leftSeed = random.next();
+        pool.spawn(worker, [&pool, &flights, &scratch, leftLow, leftHigh, depth, depthLimit, leftSeed,
+                            scratchLow](unsigned thief) {
+            parallelQuickSortTask<Order>(pool, thief, flights, leftLow, leftHigh, depth, depthLimit, leftSeed, scratch,
+                                         scratchLow);
+        });
+        low = equal.second + 1;
+    }
+    quickSort<Order>(flights, low, high);  // small or badly split ranges are finished serially
+}
+
+// Parallel quicksort on a work-stealing pool of threads (0 uses every hardware thread)
+template <typename Order = ArrivalDelayOrder, typename Record>
+void parallelQuickSort(vector<Record>& flights, int low, int high, unsigned threads) {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    if (threads == 1 || high - low + 1 <= PARALLEL_SORT_CUTOFF) {
+        quickSort<Order>(flights, low, high);
+        return;
+    }
+    int depthLimit = 0;
+    for (int n = high - low + 1; n > 1; n >>= 1) {
+        depthLimit += 2;
+    }
+    vector<Record> scratch(high - low + 1 >= PARALLEL_PARTITION_CUTOFF ? high - low + 1 : 0);
+    WorkStealingPool pool(threads);
+    pool.run([&](unsigned worker) {
+        parallelQuickSortTask<Order>(pool, worker, flights, low, high, 0, depthLimit, QUICK_SORT_SEED, scratch, low);
+    });
+}
+
+// Buckets per thread in the sample sort; more buckets than threads lets idle threads take the leftovers
+const unsigned SAMPLE_SORT_BUCKETS_PER_THREAD = 4;
+// Samples drawn per bucket to choose the sample sort splitters
+const int SAMPLE_SORT_OVERSAMPLING = 32;
+
+// Bucket sizes of one sample sort run
+struct SampleSortStats {
+    size_t buckets = 0;
+    size_t smallestBucket = 0;
+    size_t largestBucket = 0;
+    double imbalance = 0;  // largest bucket over the average bucket
+};
+
+// Sample sort of flights between indices low and high on several threads (0 uses every hardware thread).
+// Random samples, sorted, give bucket - 1 splitters. Every thread classifies its slice of the records by
+// walking a perfect binary tree of splitters, one comparison per level and no data-dependent branch.
+// Then it scatters its records into the buckets, and the threads sort whole buckets in parallel. Keys are
+// compared with their position as a tiebreak, so even long runs of equal delays spread over several buckets.
+template <typename Order = ArrivalDelayOrder, typename Record>
+void sampleSort(vector<Record>& flights, int low, int high, unsigned threads = 0, SampleSortStats* statsOut = nullptr) {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    size_t n = high < low ? 0 : high - low + 1;
+    if (threads == 1 || n <= static_cast<size_t>(PARALLEL_SORT_CUTOFF)) {
+        quickSort<Order>(flights, low, high);
+        if (statsOut != nullptr) {
+            statsOut->buckets = 1;
+            statsOut->smallestBucket = statsOut->largestBucket = n;
+            statsOut->imbalance = 1;
+        }
+        return;
+    }
+    typedef decltype(orderKey<Order>(flights[low])) Key;
+    typedef pair<Key, int> Splitter;  // (key, position)
+
+    size_t buckets = 2;
+    int levels = 1;
+    while (buckets < threads * SAMPLE_SORT_BUCKETS_PER_THREAD && buckets < (size_t(1) << 16)) {  // ids fit in 16 bits
+        buckets <<= 1;
+        ++levels;
+    }
+
+    // Oversample, then keep every SAMPLE_SORT_OVERSAMPLING-th sample as a splitter
+    PivotRandom random(QUICK_SORT_SEED);
+    vector<Splitter> samples;
+    for (size_t i = 0; i < buckets * SAMPLE_SORT_OVERSAMPLING; ++i) {
+        int position = random.between(low, high);
+        samples.push_back(Splitter(orderKey<Order>(flights[position]), position));
+    }
+    sort(samples.begin(), samples.end());
+    vector<Splitter> tree(buckets);  // splitter tree in heap order: node j has children 2j and 2j + 1
+    function<void(size_t, size_t, size_t)> place = [&](size_t node, size_t first, size_t last) {
+        if (first > last) return;
+        size_t middle = first + (last - first) / 2;
+        tree[node] = samples[(middle + 1) * SAMPLE_SORT_OVERSAMPLING - 1];
+        if (middle > first) place(2 * node, first, middle - 1);
+        place(2 * node + 1, middle + 1, last);
+    };
+    place(1, 0, buckets - 2);
+
+    // Classify and count per thread; bucketOf remembers each record's bucket for the scatter
+    vector<uint16_t> bucketOf(n);
+    vector<size_t> offsets(threads * buckets, 0);
+    runOnThreads(threads, [&](size_t t) {
+        size_t* counts = &offsets[t * buckets];
+        for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i) {
+            Key key = orderKey<Order>(flights[low + i]);
+            int position = low + static_cast<int>(i);
+            size_t node = 1;
+            for (int level = 0; level < levels; ++level) {
+                const Splitter& splitter = tree[node];
+                node = 2 * node + ((splitter.first < key) | ((splitter.first == key) & (splitter.second < position)));
+            }
+            bucketOf[i] = static_cast<uint16_t>(node - buckets);
+            ++counts[node - buckets];
+        }
+    });
+
+    // Bucket-major prefix sums: each thread writes its part of a bucket after the threads before it
+    vector<size_t> bucketStart(buckets + 1, 0);
+    size_t running = 0;
+    for (size_t b = 0; b < buckets; ++b) {
+        bucketStart[b] = running;
+        for (unsigned t = 0; t < threads; ++t) {
+            size_t count = offsets[t * buckets + b];
+            offsets[t * buckets + b] = running;
+            running += count;
+        }
+    }
+    bucketStart[buckets] = n;
+
+    vector<Record> scratch(n);
+    runOnThreads(threads, [&](size_t t) {
+        size_t* next = &offsets[t * buckets];
+        for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i) {
+            scratch[next[bucketOf[i]]++] = flights[low + i];
+        }
+    });
+
+    // Sort whole buckets in parallel, each thread taking the next unsorted bucket
+    atomic<size_t> nextBucket(0);
+    runOnThreads(threads, [&](size_t) {
+        for (size_t b = nextBucket++; b < buckets; b = nextBucket++) {
+            int first = static_cast<int>(bucketStart[b]), last = static_cast<int>(bucketStart[b + 1]) - 1;
+            if (first > last) continue;
+            quickSort<Order>(scratch, first, last);
+            copy(scratch.begin() + first, scratch.begin() + last + 1, flights.begin() + low + first);
+        }
+    });
+
+    if (statsOut != nullptr) {
+        statsOut->buckets = buckets;
+        statsOut->smallestBucket = n;
+        statsOut->largestBucket = 0;
+        for (size_t b = 0; b < buckets; ++b) {
+            statsOut->smallestBucket = min(statsOut->smallestBucket, bucketStart[b + 1] - bucketStart[b]);
+            statsOut->largestBucket = max(statsOut->largestBucket, bucketStart[b + 1] - bucketStart[b]);
+        }
+        statsOut->imbalance = static_cast<double>(statsOut->largestBucket) * buckets / n;
+    }
+}
+
+// Functions to return the run length smallSort sorts before merge sort starts merging
+inline size_t mergeSortRun(const uint64_t*) { return SORTING_NETWORK_CUTOFF; }
+inline size_t mergeSortRun(const Flight*) { return 2 * INSERTION_SORT_CUTOFF; }
+
+// Function to stably merge the sorted ranges [a, aEnd) and [b, bEnd) into out; ties are taken from a
+template <typename Order, typename Record>
+void mergeRuns(const Record* a, const Record* aEnd, const Record* b, const Record* bEnd, Record* out) {
+    while (a < aEnd && b < bEnd) {
+        if (orderKey<Order>(*b) < orderKey<Order>(*a)) *out++ = *b++;
+        else *out++ = *a++;
+    }
+    out = copy(a, aEnd, out);
+    copy(b, bEnd, out);
+}
+
+// Function to find how many of the first k outputs of a stable merge of a[0, aSize) and b[0, bSize)
+// come from a (the merge-path co-rank), by binary search on the split of k between the two inputs
+template <typename Order, typename Record>
+size_t mergeCoRank(size_t k, const Record* a, size_t aSize, const Record* b, size_t bSize) {
+    size_t low = k > bSize ? k - bSize : 0;
+    size_t high = min(k, aSize);
+    while (low < high) {
+        size_t i = low + (high - low) / 2;
+        size_t j = k - i;
+        if (j > 0 && !(orderKey<Order>(b[j - 1]) < orderKey<Order>(a[i]))) {
+            low = i + 1;  // a[i] is merged before b[j - 1], so more than i outputs come from a
+        } else {
+            high = i;
+        }
+    }
+    return low;
+}
+
+// Function to stably merge sort data[0, n) with a bottom-up merge sort that ping-pongs with scratch[0, n).
+// The sorted result always ends up back in data.
+template <typename Order, typename Record>
+void mergeSortSegment(Record* data, Record* scratch, size_t n) {
+    const size_t firstRun = mergeSortRun(data);
+    for (size_t run = 0; run < n; run += firstRun) {  // sort short runs with smallSort first
+        smallSort<Order>(data + run, min(n - run, firstRun));
+    }
+
+    Record* source = data;
+    Record* target = scratch;
+    for (size_t width = firstRun; width < n; width *= 2) {
+        for (size_t low = 0; low < n; low += 2 * width) {
+            size_t mid = min(n, low + width), high = min(n, low + 2 * width);
+            mergeRuns<Order>(source + low, source + mid, source + mid, source + high, target + low);
+        }
+        swap(source, target);
+    }
+    if (source != data) {
+        copy(source, source + n, data);
+    }
+}
+
+// MergeSort function to stably sort flights between indices left and right based on arr_delay.
+// The range is cut into one leaf per thread and the leaves are sorted in parallel. Then pairs of
+// sorted segments are merged level by level. Merge-path co-ranks split every merge into equal
+// output slices, so the last levels use all threads too. A single scratch buffer is allocated
+// up front, and each level merges from one buffer into the other.
+template <typename Order = ArrivalDelayOrder, typename Record>
+void mergeSort(vector<Record>& flights, int left, int right, unsigned threads = 0) {
+    if (left >= right) return;
+    size_t n = right - left + 1;
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    threads = static_cast<unsigned>(min<size_t>(threads, max<size_t>(1, n / PARALLEL_SORT_CUTOFF)));
+
+    vector<Record> scratch(n);
+    Record* source = &flights[left];
+    Record* target = scratch.data();
+
+    vector<size_t> bounds(threads + 1);  // segment i is [bounds[i], bounds[i + 1])
+    for (unsigned i = 0; i <= threads; ++i) {
+        bounds[i] = n * i / threads;
+    }
+    runOnThreads(threads, [&](size_t leaf) {
+        mergeSortSegment<Order>(source + bounds[leaf], target + bounds[leaf], bounds[leaf + 1] - bounds[leaf]);
+    });
+
+    // Each job writes one output slice of one merge (or copies an unpaired last segment)
+    struct MergeJob {
+        size_t low, mid, high;  // the merge of [low, mid) and [mid, high)
+        size_t outBegin, outEnd;  // output positions of this slice, relative to low
+    };
+    vector<MergeJob> jobs;
+    while (bounds.size() > 2) {
+        size_t merges = (bounds.size() - 1) / 2;
+        size_t slicesPerMerge = max<size_t>(1, threads / merges);
+        jobs.clear();
+        vector<size_t> nextBounds(1, 0);
+        for (size_t segment = 0; segment + 1 < bounds.size(); segment += 2) {
+            size_t low = bounds[segment];
+            size_t mid = bounds[segment + 1];
+            size_t high = segment + 2 < bounds.size() ? bounds[segment + 2] : mid;  // an unpaired segment is copied
+            size_t length = high - low;
+            for (size_t slice = 0; slice < slicesPerMerge; ++slice) {
+                MergeJob job = {low, mid, high, length * slice / slicesPerMerge, length * (slice + 1) / slicesPerMerge};
+                jobs.push_back(job);
+            }
+            nextBounds.push_back(high);
+        }
+
+        runOnThreads(jobs.size(), [&](size_t index) {
+            const MergeJob& job = jobs[index];
+            const Record* a = source + job.low;
+            const Record* b = source + job.mid;
+            size_t aSize = job.mid - job.low, bSize = job.high - job.mid;
+            size_t aBegin = mergeCoRank<Order>(job.outBegin, a, aSize, b, bSize);
+            size_t aEnd = mergeCoRank<Order>(job.outEnd, a, aSize, b, bSize);
+            mergeRuns<Order>(a + aBegin, a + aEnd, b + (job.outBegin - aBegin), b + (job.outEnd - aEnd),
+                      target + job.low + job.outBegin);
+        });
+        bounds.swap(nextBounds);
+        swap(source, target);
+    }
+
+    if (source != &flights[left]) {  // the last level wrote into scratch
+        runOnThreads(threads, [&](size_t part) {
+            copy(source + n * part / threads, source + n * (part + 1) / threads, flights.begin() + left + n * part / threads);
+        });
+    }
+}
+
+// Tuning constants of the pattern-defeating quicksort
+const int PDQ_INSERTION_SORT_THRESHOLD = 24;  // ranges below this are insertion sorted
+const int PDQ_NINTHER_THRESHOLD = 128;        // ranges above this pick the pivot with a ninther
+const int PDQ_PARTIAL_INSERTION_LIMIT = 8;    // moves allowed when guessing a side is already sorted
+const int PDQ_BLOCK_SIZE = 64;                // elements classified per block in the branchless partition
+
+// Function to insertion sort [begin, end). When unguarded, the element before begin must be no greater
+// than any element in the range, which lets the inner loop drop its bounds check.
+template <typename Order, typename Record>
+void pdqInsertionSort(Record* begin, Record* end, bool unguarded) {
+    if (begin == end) return;
+    for (Record* current = begin + 1; current != end; ++current) {
+        Record* sift = current;
+        Record* siftPrevious = current - 1;
+        if (orderKey<Order>(*sift) < orderKey<Order>(*siftPrevious)) {
+            Record value = *sift;
+            auto key = orderKey<Order>(value);
+            do {
+                *sift-- = *siftPrevious;
+            } while ((unguarded || sift != begin) && key < orderKey<Order>(*--siftPrevious));
+            *sift = value;
+        }
+    }
+}
+
+// Function to insertion sort [begin, end) but give up after a few moves; returns true if the range got sorted
+template <typename Order, typename Record>
+bool pdqPartialInsertionSort(Record* begin, Record* end) {
+    if (begin == end) return true;
+    size_t moves = 0;
+    for (Record* current = begin + 1; current != end; ++current) {
+        Record* sift = current;
+        Record* siftPrevious = current - 1;
+        if (orderKey<Order>(*sift) < orderKey<Order>(*siftPrevious)) {
+            Record value = *sift;
+            auto key = orderKey<Order>(value);
+            do {
+                *sift-- = *siftPrevious;
+            } while (sift != begin && key < orderKey<Order>(*--siftPrevious));
+            *sift = value;
+            moves += current - sift;
+        }
+        if (moves > PDQ_PARTIAL_INSERTION_LIMIT) return false;
+    }
+    return true;
+}
+
+// Function to order three elements in place by key
+template <typename Order, typename Record>
+void pdqSort3(Record* a, Record* b, Record* c) {
+    if (orderKey<Order>(*b) < orderKey<Order>(*a)) swap(*a, *b);
+    if (orderKey<Order>(*c) < orderKey<Order>(*b)) swap(*b, *c);
+    if (orderKey<Order>(*b) < orderKey<Order>(*a)) swap(*a, *b);
+}
+
+// Function to swap the elements found out of place by a block partition, pairing offsetsLeft[i] from
+// the left base with offsetsRight[i] from the right base; a cyclic rotation is used when the counts match
+template <typename Order, typename Record>
+void pdqSwapOffsets(Record* first, Record* last, const unsigned char* offsetsLeft, const unsigned char* offsetsRight,
+                    size_t count, bool useSwaps) {
+    if (useSwaps) {
+        for (size_t i = 0; i < count; ++i) {
+            swap(first[offsetsLeft[i]], *(last - offsetsRight[i]));
+        }
+    } else if (count > 0) {
+        Record* left = first + offsetsLeft[0];
+        Record* right = last - offsetsRight[0];
+        Record value = *left;
+        *left = *right;
+        for (size_t i = 1; i < count; ++i) {
+            left = first + offsetsLeft[i];
+            *right = *left;
+            right = last - offsetsRight[i];
+            *left = *right;
+        }
+        *right = value;
+    }
+}
+
+// Function to partition [begin, end) around *begin into keys < pivot and keys >= pivot, classifying
+// PDQ_BLOCK_SIZE elements at a time. Comparison results are stored as byte offsets
+// (offsets[n] = i; n += result) rather than branched on, so the loop does not depend on
+// branch prediction. Returns the pivot's final position and whether the range was already partitioned.
+template <typename Order, typename Record>
+pair<Record*, bool> pdqPartitionRightBranchless(Record* begin, Record* end) {
+    Record pivot = *begin;
+    auto pivotKey = orderKey<Order>(pivot);
+    Record* first = begin;
+    Record* last = end;
+
+    // Find the first element >= pivot (the median-of-3 guarantees one exists) and the last one < pivot
+    while (orderKey<Order>(*++first) < pivotKey) {}
+    if (first - 1 == begin) {
+        while (first < last && !(orderKey<Order>(*--last) < pivotKey)) {}
+    } else {
+        while (!(orderKey<Order>(*--last) < pivotKey)) {}
+    }
+
+    bool alreadyPartitioned = first >= last;
+    if (!alreadyPartitioned) {
+        swap(*first, *last);
+        ++first;
+
+        unsigned char offsetsLeft[PDQ_BLOCK_SIZE];
+        unsigned char offsetsRight[PDQ_BLOCK_SIZE];
+        Record* leftBase = first;
+        Record* rightBase = last;
+        size_t countLeft = 0, countRight = 0, startLeft = 0, startRight = 0;
+
+        while (first < last) {
+            // Fill the offset buffers that ran empty, splitting the unknown middle between them if both did
+            size_t unknown = last - first;
+            size_t leftSplit = countLeft == 0 ? (countRight == 0 ? unknown / 2 : unknown) : 0;
+            size_t rightSplit = countRight == 0 ? (unknown - leftSplit) : 0;
+
+            size_t leftBlock = min<size_t>(leftSplit, PDQ_BLOCK_SIZE);
+            for (size_t i = 0; i < leftBlock; ++i) {
+                offsetsLeft[countLeft] = static_cast<unsigned char>(i);
+                countLeft += !(orderKey<Order>(*first) < pivotKey);  // element >= pivot belongs on the right
+                ++first;
+            }
+            size_t rightBlock = min<size_t>(rightSplit, PDQ_BLOCK_SIZE);
+            for (size_t i = 0; i < rightBlock;) {
+                offsetsRight[countRight] = static_cast<unsigned char>(++i);
+                countRight += orderKey<Order>(*--last) < pivotKey;  // element < pivot belongs on the left
+            }
+
+            size_t count = min(countLeft, countRight);
+            pdqSwapOffsets<Order>(leftBase, rightBase, offsetsLeft + startLeft, offsetsRight + startRight, count,
+                           countLeft == countRight);
+            countLeft -= count;
+            countRight -= count;
+            startLeft += count;
+            startRight += count;
+            if (countLeft == 0) {
+                startLeft = 0;
+                leftBase = first;
+            }
+            if (countRight == 0) {
+                startRight = 0;
+                rightBase = last;
+            }
+        }
+
+        // One side may still hold misplaced elements; move them across the boundary
+        if (countLeft) {
+            const unsigned char* offsets = offsetsLeft + startLeft;
+            while (countLeft--) swap(leftBase[offsets[countLeft]], *--last);
+            first = last;
+        }
+        if (countRight) {
+            const unsigned char* offsets = offsetsRight + startRight;
+            while (countRight--) {
+                swap(*(rightBase - offsets[countRight]), *first);
+                ++first;
+            }
+            last = first;
+        }
+    }
+
+    Record* pivotPosition = first - 1;
+    *begin = *pivotPosition;
+    *pivotPosition = pivot;
+    return make_pair(pivotPosition, alreadyPartitioned);
+}
+
+// Function to partition [begin, end) around *begin into keys == pivot and keys > pivot. Used when the pivot
+// equals the element just before the range, so every key equal to it is already in its final place.
+template <typename Order, typename Record>
+Record* pdqPartitionLeft(Record* begin, Record* end) {
+    Record pivot = *begin;
+    auto pivotKey = orderKey<Order>(pivot);
+    Record* first = begin;
+    Record* last = end;
+
+    while (pivotKey < orderKey<Order>(*--last)) {}
+    if (last + 1 == end) {
+        while (first < last && !(pivotKey < orderKey<Order>(*++first))) {}
+    } else {
+        while (!(pivotKey < orderKey<Order>(*++first))) {}
+    }
+    while (first < last) {
+        swap(*first, *last);
+        while (pivotKey < orderKey<Order>(*--last)) {}
+        while (!(pivotKey < orderKey<Order>(*++first))) {}
+    }
+
+    *begin = *last;
+    *last = pivot;
+    return last;
+}
+
+// Function to run the pattern-defeating quicksort loop on [begin, end). badAllowed counts the highly
+// unbalanced partitions left before falling back to heapsort; leftmost is false when the element before
+// begin is known to be no greater than the whole range.
+template <typename Order, typename Record>
+void pdqSortLoop(Record* begin, Record* end, int badAllowed, bool leftmost) {
+    while (true) {
+        ptrdiff_t size = end - begin;
+        if (size < PDQ_INSERTION_SORT_THRESHOLD) {
+            pdqInsertionSort<Order>(begin, end, !leftmost);
+            return;
+        }
+
+        // Move the median of three (or the ninther) to begin as the pivot
+        ptrdiff_t half = size / 2;
+        if (size > PDQ_NINTHER_THRESHOLD) {
+            pdqSort3<Order>(begin, begin + half, end - 1);
+            pdqSort3<Order>(begin + 1, begin + (half - 1), end - 2);
+            pdqSort3<Order>(begin + 2, begin + (half + 1), end - 3);
+            pdqSort3<Order>(begin + (half - 1), begin + half, begin + (half + 1));
+            swap(*begin, *(begin + half));
+        } else {
+            pdqSort3<Order>(begin + half, begin, end - 1);
+        }
+
+        // A pivot equal to its predecessor means this range is full of duplicates of it; split them off in one pass
+        if (!leftmost && !(orderKey<Order>(*(begin - 1)) < orderKey<Order>(*begin))) {
+            begin = pdqPartitionLeft<Order>(begin, end) + 1;
+            continue;
+        }
+
+        pair<Record*, bool> partition = pdqPartitionRightBranchless<Order>(begin, end);
+        Record* pivotPosition = partition.first;
+        ptrdiff_t leftSize = pivotPosition - begin;
+        ptrdiff_t rightSize = end - (pivotPosition + 1);
+
+        if (leftSize < size / 8 || rightSize < size / 8) {
+            // Highly unbalanced: too many of these fall back to heapsort, otherwise shuffle to break the pattern
+            if (--badAllowed == 0) {
+                auto less = [](const Record& a, const Record& b) { return orderKey<Order>(a) < orderKey<Order>(b); };
+                make_heap(begin, end, less);
+                sort_heap(begin, end, less);
+                return;
+            }
+            if (leftSize >= PDQ_INSERTION_SORT_THRESHOLD) {
+                swap(*begin, *(begin + leftSize / 4));
+                swap(*(pivotPosition - 1), *(pivotPosition - leftSize / 4));
+                if (leftSize > PDQ_NINTHER_THRESHOLD) {
+                    swap(*(begin + 1), *(begin + (leftSize / 4 + 1)));
+                    swap(*(begin + 2), *(begin + (leftSize / 4 + 2)));
+                    swap(*(pivotPosition - 2), *(pivotPosition - (leftSize / 4 + 1)));
+                    swap(*(pivotPosition - 3), *(pivotPosition - (leftSize / 4 + 2)));
+                }
+            }
+            if (rightSize >= PDQ_INSERTION_SORT_THRESHOLD) {
+                swap(*(pivotPosition + 1), *(pivotPosition + (1 + rightSize / 4)));
+                swap(*(end - 1), *(end - rightSize / 4));
+                if (rightSize > PDQ_NINTHER_THRESHOLD) {
+                    swap(*(pivotPosition + 2), *(pivotPosition + (2 + rightSize / 4)));
+                    swap(*(pivotPosition + 3), *(pivotPosition + (3 + rightSize / 4)));
+                    swap(*(end - 2), *(end - (1 + rightSize / 4)));
+                    swap(*(end - 3), *(end - (2 + rightSize / 4)));
+                }
+            }
+        } else if (partition.second && pdqPartialInsertionSort<Order>(begin, pivotPosition) &&
+                   pdqPartialInsertionSort<Order>(pivotPosition + 1, end)) {
+            return;  // nothing moved during partitioning and both sides were (nearly) sorted: done in linear time
+        }
+
+        pdqSortLoop<Order>(begin, pivotPosition, badAllowed, leftmost);
+        begin = pivotPosition + 1;
+        leftmost = false;
+    }
+}
 
-// Function to trim leading and trailing whitespaces from a string
-string trim(const string& str) {
-    size_t first = str.find_first_not_of(" \t\r\n");  // find first non-whitespace character
-    if (first == string::npos)
-        return "";  // return empty string if no non-whitespace character found
-    size_t last = str.find_last_not_of(" \t\r\n");   // find last non-whitespace character
-    return str.substr(first, (last - first + 1));  // return the formatted string
+// Pattern-defeating quicksort (pdqsort) of flights between indices low and high. Partitions are done
+// branchlessly in blocks, and sorted or reverse-sorted input is detected as already partitioned and
+// finished by a bounded insertion sort, so the best and worst case inputs take near-linear time.
+template <typename Order = ArrivalDelayOrder, typename Record>
+void pdqSort(vector<Record>& flights, int low, int high) {
+    if (low >= high) return;
+    int badAllowed = 0;
+    for (int n = high - low + 1; n > 0; n >>= 1) {
+        ++badAllowed;  // log2(n) bad partitions before heapsort
+    }
+    pdqSortLoop<Order>(&flights[low], &flights[high] + 1, badAllowed, true);
 }
 
-// Function to parse a CSV line into tokens separated by a delimiter
-vector<string> parseCSVLine(const string& line, char delimiter) {
-    vector<string> item;  // vector to store the parsed item
-    string currItem;           // current currItem being processed
-    bool inside_quotes = false;  // flag to check if the current character is inside quotes
+// Tuning constants of the natural-run merge sort
+const int TIM_SORT_MIN_MERGE = 32;  // runs shorter than this are extended by binary insertion sort
+const int TIM_SORT_MIN_GALLOP = 7;  // wins in a row before a merge switches to galloping
 
-    for (size_t i = 0; i < line.length(); ++i) {
-        char c = line[i];
+// Class holding the state of one TimSort-style natural merge sort: the records, a merge buffer that only
+// grows, the stack of pending runs and the adaptive galloping threshold
+template <typename Order, typename Record>
+class TimSorter {
+public:
+    explicit TimSorter(Record* records) : a(records) {}
 
-        if (c == '"') {  // if quote character is encountered
-            if (inside_quotes && i + 1 < line.length() && line[i + 1] == '"') {
-                currItem += '"';  // escaped quote inside quoted field
-                ++i;
-            } else {
-                inside_quotes = !inside_quotes;  // toggle inside_quotes flag
+    // Sorts a[0, n) stably
+    void sort(size_t n) {
+        if (n < 2) return;
+        ptrdiff_t low = 0, remaining = static_cast<ptrdiff_t>(n);
+        ptrdiff_t minRun = minRunLength(remaining);
+        while (remaining != 0) {
+            ptrdiff_t runLength = countRunAndMakeAscending(low, low + remaining);
+            if (runLength < minRun) {  // extend short runs to minRun so the merges stay balanced
+                ptrdiff_t forced = min(remaining, minRun);
+                binaryInsertionSort(low, low + forced, low + runLength);
+                runLength = forced;
+            }
+            runBase.push_back(low);
+            runLengths.push_back(runLength);
+            mergeCollapse();
+            low += runLength;
+            remaining -= runLength;
+        }
+        mergeForceCollapse();
+    }
+
+private:
+    typedef decltype(orderKey<Order>(declval<Record>())) Key;
+
+    // Run length below which runs are extended: n / 2^k in [MIN_MERGE / 2, MIN_MERGE], rounded up
+    static ptrdiff_t minRunLength(ptrdiff_t n) {
+        ptrdiff_t roundUp = 0;
+        while (n >= TIM_SORT_MIN_MERGE) {
+            roundUp |= n & 1;
+            n >>= 1;
+        }
+        return n + roundUp;
+    }
+
+    // Returns the length of the run starting at low. A descending run (ties allowed) is reversed in place,
+    // then each block of equal keys is reversed back, so equal keys keep their input order
+    ptrdiff_t countRunAndMakeAscending(ptrdiff_t low, ptrdiff_t high) {
+        ptrdiff_t runHigh = low + 1;
+        if (runHigh == high) return 1;
+        if (orderKey<Order>(a[runHigh]) < orderKey<Order>(a[low])) {
+            while (runHigh < high && !(orderKey<Order>(a[runHigh - 1]) < orderKey<Order>(a[runHigh]))) ++runHigh;
+            reverse(a + low, a + runHigh);
+            for (ptrdiff_t blockStart = low; blockStart < runHigh;) {
+                ptrdiff_t blockEnd = blockStart + 1;
+                while (blockEnd < runHigh && orderKey<Order>(a[blockEnd]) == orderKey<Order>(a[blockStart])) ++blockEnd;
+                reverse(a + blockStart, a + blockEnd);
+                blockStart = blockEnd;
             }
-        } else if (c == delimiter && !inside_quotes) {  // if delimiter is found outside quotes
-            item.push_back(trim(currItem));  // add currItem to the vector and clear it
-            currItem.clear();
         } else {
-            currItem += c;  // otherwise, add the character to the currItem
+            ++runHigh;
+            while (runHigh < high && !(orderKey<Order>(a[runHigh]) < orderKey<Order>(a[runHigh - 1]))) ++runHigh;
         }
+        return runHigh - low;
     }
-    item.push_back(trim(currItem));  // add the last currItem
-    return item;
+
+    // Inserts a[start, high) one by one into the sorted a[low, start), after any equal keys
+    void binaryInsertionSort(ptrdiff_t low, ptrdiff_t high, ptrdiff_t start) {
+        for (; start < high; ++start) {
+            Record pivot = a[start];
+            Record* position = upper_bound(a + low, a + start, pivot, [](const Record& x, const Record& y) {
+                return orderKey<Order>(x) < orderKey<Order>(y);
+            });
+            copy_backward(position, a + start, a + start + 1);
+            *position = pivot;
+        }
+    }
+
+    // Returns how many elements of base[0, length) are < key, galloping out from base[hint]
+    static ptrdiff_t gallopLeft(Key key, const Record* base, ptrdiff_t length, ptrdiff_t hint) {
+        ptrdiff_t lastOffset = 0, offset = 1;
+        if (orderKey<Order>(base[hint]) < key) {
+            ptrdiff_t maxOffset = length - hint;  // gallop right until base[hint + lastOffset] < key <= base[hint + offset]
+            while (offset < maxOffset && orderKey<Order>(base[hint + offset]) < key) {
+                lastOffset = offset;
+                offset = 2 * offset + 1;
+            }
+            if (offset > maxOffset) offset = maxOffset;
+            lastOffset += hint;
+            offset += hint;
+        } else {
+            ptrdiff_t maxOffset = hint + 1;  // gallop left until base[hint - offset] < key <= base[hint - lastOffset]
+            while (offset < maxOffset && !(orderKey<Order>(base[hint - offset]) < key)) {
+                lastOffset = offset;
+                offset = 2 * offset + 1;
+            }
+            if (offset > maxOffset) offset = maxOffset;
+            ptrdiff_t previous = lastOffset;
+            lastOffset = hint - offset;
+            offset = hint - previous;
+        }
+        ++lastOffset;  // binary search in (lastOffset - 1, offset]
+        while (lastOffset < offset) {
+            ptrdiff_t middle = lastOffset + (offset - lastOffset) / 2;
+            if (orderKey<Order>(base[middle]) < key) lastOffset = middle + 1;
+            else offset = middle;
+        }
+        return offset;
+    }
+
+    // Returns how many elements of base[0, length) are <= key, galloping out from base[hint]
+    static ptrdiff_t gallopRight(Key key, const Record* base, ptrdiff_t length, ptrdiff_t hint) {
+        ptrdiff_t lastOffset = 0, offset = 1;
+        if (key < orderKey<Order>(base[hint])) {
+            ptrdiff_t maxOffset = hint + 1;  // gallop left until base[hint - offset] <= key < base[hint - lastOffset]
+            while (offset < maxOffset && key < orderKey<Order>(base[hint - offset])) {
+                lastOffset = offset;
+                offset = 2 * offset + 1;
+            }
+            if (offset > maxOffset) offset = maxOffset;
+            ptrdiff_t previous = lastOffset;
+            lastOffset = hint - offset;
+            offset = hint - previous;
+        } else {
+            ptrdiff_t maxOffset = length - hint;  // gallop right until base[hint + lastOffset] <= key < base[hint + offset]
+            while (offset < maxOffset && !(key < orderKey<Order>(base[hint + offset]))) {
+                lastOffset = offset;
+                offset = 2 * offset + 1;
+            }
+            if (offset > maxOffset) offset = maxOffset;
+            lastOffset += hint;
+            offset += hint;
+        }
+        ++lastOffset;
+        while (lastOffset < offset) {
+            ptrdiff_t middle = lastOffset + (offset - lastOffset) / 2;
+            if (key < orderKey<Order>(base[middle])) offset = middle;
+            else lastOffset = middle + 1;
+        }
+        return offset;
+    }
+
+    // Merges runs until the stack lengths satisfy len[i-2] > len[i-1] + len[i] and len[i-1] > len[i]
+    // (also checked one run deeper, which the original TimSort missed)
+    void mergeCollapse() {
+        while (runBase.size() > 1) {
+            ptrdiff_t n = static_cast<ptrdiff_t>(runBase.size()) - 2;
+            if ((n > 0 && runLengths[n - 1] <= runLengths[n] + runLengths[n + 1]) ||
+                (n > 1 && runLengths[n - 2] <= runLengths[n] + runLengths[n - 1])) {
+                if (runLengths[n - 1] < runLengths[n + 1]) --n;
+            } else if (runLengths[n] > runLengths[n + 1]) {
+                break;  // invariants hold
+            }
+            mergeAt(n);
+        }
+    }
+
+    // Merges every pending run once the input is exhausted
+    void mergeForceCollapse() {
+        while (runBase.size() > 1) {
+            ptrdiff_t n = static_cast<ptrdiff_t>(runBase.size()) - 2;
+            if (n > 0 && runLengths[n - 1] < runLengths[n + 1]) --n;
+            mergeAt(n);
+        }
+    }
+
+    // Merges stack runs i and i + 1
+    void mergeAt(ptrdiff_t i) {
+        ptrdiff_t base1 = runBase[i], length1 = runLengths[i];
+        ptrdiff_t base2 = runBase[i + 1], length2 = runLengths[i + 1];
+        runLengths[i] = length1 + length2;
+        runBase.erase(runBase.begin() + i + 1);
+        runLengths.erase(runLengths.begin() + i + 1);
+
+        // Elements of run 1 before the start of run 2, and of run 2 after the end of run 1, are already in place
+        ptrdiff_t skip = gallopRight(orderKey<Order>(a[base2]), a + base1, length1, 0);
+        base1 += skip;
+        length1 -= skip;
+        if (length1 == 0) return;
+        length2 = gallopLeft(orderKey<Order>(a[base1 + length1 - 1]), a + base2, length2, length2 - 1);
+        if (length2 == 0) return;
+
+        if (length1 <= length2) mergeLow(base1, length1, base2, length2);
+        else mergeHigh(base1, length1, base2, length2);
+    }
+
+    // Merges adjacent runs front to back, buffering the shorter first run
+    void mergeLow(ptrdiff_t base1, ptrdiff_t length1, ptrdiff_t base2, ptrdiff_t length2) {
+        buffer.assign(a + base1, a + base1 + length1);
+        Record* temp = buffer.data();
+        ptrdiff_t cursor1 = 0, cursor2 = base2, dest = base1;
+
+        a[dest++] = a[cursor2++];
+        if (--length2 == 0) {
+            copy(temp + cursor1, temp + cursor1 + length1, a + dest);
+            return;
+        }
+        if (length1 == 1) {
+            copy(a + cursor2, a + cursor2 + length2, a + dest);
+            a[dest + length2] = temp[cursor1];
+            return;
+        }
+
+        int gallopThreshold = minGallop;
+        while (true) {
+            ptrdiff_t count1 = 0, count2 = 0;  // consecutive wins of each run
+            bool done = false;
+            do {  // one element at a time until one run keeps winning
+                if (orderKey<Order>(a[cursor2]) < orderKey<Order>(temp[cursor1])) {
+                    a[dest++] = a[cursor2++];
+                    ++count2;
+                    count1 = 0;
+                    if (--length2 == 0) { done = true; break; }
+                } else {
+                    a[dest++] = temp[cursor1++];
+                    ++count1;
+                    count2 = 0;
+                    if (--length1 == 1) { done = true; break; }
+                }
+            } while ((count1 | count2) < gallopThreshold);
+            if (done) break;
+
+            do {  // gallop: copy whole stretches found by exponential search
+                count1 = gallopRight(orderKey<Order>(a[cursor2]), temp + cursor1, length1, 0);
+                if (count1 != 0) {
+                    copy(temp + cursor1, temp + cursor1 + count1, a + dest);
+                    dest += count1;
+                    cursor1 += count1;
+                    length1 -= count1;
+                    if (length1 <= 1) { done = true; break; }
+                }
+                a[dest++] = a[cursor2++];
+                if (--length2 == 0) { done = true; break; }
+
+                count2 = gallopLeft(orderKey<Order>(temp[cursor1]), a + cursor2, length2, 0);
+                if (count2 != 0) {
+                    copy(a + cursor2, a + cursor2 + count2, a + dest);
+                    dest += count2;
+                    cursor2 += count2;
+                    length2 -= count2;
+                    if (length2 == 0) { done = true; break; }
+                }
+                a[dest++] = temp[cursor1++];
+                if (--length1 == 1) { done = true; break; }
+                --gallopThreshold;  // galloping pays off: enter it sooner next time
+            } while (count1 >= TIM_SORT_MIN_GALLOP || count2 >= TIM_SORT_MIN_GALLOP);
+            if (done) break;
+            if (gallopThreshold < 0) gallopThreshold = 0;
+            gallopThreshold += 2;  // galloping stopped paying off: make it harder to enter
+        }
+        minGallop = max(1, gallopThreshold);
+
+        if (length1 == 1) {
+            copy(a + cursor2, a + cursor2 + length2, a + dest);
+            a[dest + length2] = temp[cursor1];  // the last element of run 1 goes after everything else
+        } else {
+            copy(temp + cursor1, temp + cursor1 + length1, a + dest);
+        }
+    }
+
+    // Merges adjacent runs back to front, buffering the shorter second run
+    void mergeHigh(ptrdiff_t base1, ptrdiff_t length1, ptrdiff_t base2, ptrdiff_t length2) {
+        buffer.assign(a + base2, a + base2 + length2);
+        Record* temp = buffer.data();
+        ptrdiff_t cursor1 = base1 + length1 - 1, cursor2 = length2 - 1, dest = base2 + length2 - 1;
+
+        a[dest--] = a[cursor1--];
+        if (--length1 == 0) {
+            copy(temp, temp + length2, a + dest - (length2 - 1));
+            return;
+        }
+        if (length2 == 1) {
+            dest -= length1;
+            cursor1 -= length1;
+            copy_backward(a + cursor1 + 1, a + cursor1 + 1 + length1, a + dest + 1 + length1);
+            a[dest] = temp[cursor2];
+            return;
+        }
+
+        int gallopThreshold = minGallop;
+        while (true) {
+            ptrdiff_t count1 = 0, count2 = 0;
+            bool done = false;
+            do {
+                if (orderKey<Order>(temp[cursor2]) < orderKey<Order>(a[cursor1])) {
+                    a[dest--] = a[cursor1--];
+                    ++count1;
+                    count2 = 0;
+                    if (--length1 == 0) { done = true; break; }
+                } else {
+                    a[dest--] = temp[cursor2--];
+                    ++count2;
+                    count1 = 0;
+                    if (--length2 == 1) { done = true; break; }
+                }
+            } while ((count1 | count2) < gallopThreshold);
+            if (done) break;
+
+            do {
+                count1 = length1 - gallopRight(orderKey<Order>(temp[cursor2]), a + base1, length1, length1 - 1);
+                if (count1 != 0) {
+                    dest -= count1;
+                    cursor1 -= count1;
+                    length1 -= count1;
+                    copy_backward(a + cursor1 + 1, a + cursor1 + 1 + count1, a + dest + 1 + count1);
+                    if (length1 == 0) { done = true; break; }
+                }
+                a[dest--] = temp[cursor2--];
+                if (--length2 == 1) { done = true; break; }
+
+                count2 = length2 - gallopLeft(orderKey<Order>(a[cursor1]), temp, length2, length2 - 1);
+                if (count2 != 0) {
+                    dest -= count2;
+                    cursor2 -= count2;
+                    length2 -= count2;
+                    copy(temp + cursor2 + 1, temp + cursor2 + 1 + count2, a + dest + 1);
+                    if (length2 <= 1) { done = true; break; }
+                }
+                a[dest--] = a[cursor1--];
+                if (--length1 == 0) { done = true; break; }
+                --gallopThreshold;
+            } while (count1 >= TIM_SORT_MIN_GALLOP || count2 >= TIM_SORT_MIN_GALLOP);
+            if (done) break;
+            if (gallopThreshold < 0) gallopThreshold = 0;
+            gallopThreshold += 2;
+        }
+        minGallop = max(1, gallopThreshold);
+
+        if (length2 == 1) {
+            dest -= length1;
+            cursor1 -= length1;
+            copy_backward(a + cursor1 + 1, a + cursor1 + 1 + length1, a + dest + 1 + length1);
+            a[dest] = temp[cursor2];  // the first element of run 2 goes before everything else
+        } else {
+            copy(temp, temp + length2, a + dest - (length2 - 1));
+        }
+    }
+
+    Record* a;                      // records being sorted
+    vector<Record> buffer;          // copy of the shorter run during a merge; keeps its capacity
+    vector<ptrdiff_t> runBase;      // start of each pending run
+    vector<ptrdiff_t> runLengths;   // length of each pending run
+    int minGallop = TIM_SORT_MIN_GALLOP;  // adaptive threshold for entering galloping mode
+};
+
+// Natural-run adaptive merge sort (TimSort) of flights between indices low and high. Ascending runs are
+// used as they are and descending runs are reversed, so sorted and reverse-sorted input is one run
+// and costs O(n). The sort is stable: equal delays keep their input (file) order.
+template <typename Order = ArrivalDelayOrder, typename Record>
+void timSort(vector<Record>& flights, int low, int high) {
+    if (low >= high) return;
+    TimSorter<Order, Record> sorter(&flights[low]);
+    sorter.sort(high - low + 1);
 }
 
-// Function to read flight data from a CSV file
-vector<Flight> readFlightData(const string& filename) {
-    vector<Flight> flights;  // vector to store the flight data
-    ifstream file(filename);  // open the file
+// Smallest read buffer, in records, given to each run during the external merge
+const size_t EXTERNAL_SORT_MIN_READ_RECORDS = 1 << 13;
+// Most runs merged at once; more runs are merged in several passes, which also bounds the open files
+const size_t EXTERNAL_SORT_MAX_FAN_IN = 64;
 
-    if (!file.is_open()) {  // check if the file is opened successfully
-        cerr << "Failed to open file: " << filename << endl;
-        return flights;  // return an empty vector if file cannot be opened
+// Class to sort more records than fit in memory. Records are buffered up to the memory budget; each full
+// buffer is radix sorted and written to its own spill file as one sorted run. Once all records were added,
+// the runs are merged through a loser tree, each run read back through a large sequential buffer, and the
+// result is streamed out one record at a time. The sort is stable: ties go to the earlier run.
+template <typename Order, typename Record>
+class ExternalMergeSorter {
+public:
+    // memoryBytes bounds the run buffer (records plus the radix sort's scratch copy) and the merge buffers
+    ExternalMergeSorter(size_t memoryBytes, const string& directory)
+        : memoryBytes(memoryBytes), directory(directory),
+          runCapacity(max<size_t>(1, memoryBytes / (2 * sizeof(Record)))) {
+        filePrefix = "project3-run-" + to_string(high_resolution_clock::now().time_since_epoch().count()) + "-" +
+                     to_string(reinterpret_cast<uintptr_t>(this)) + "-";
     }
 
-    string line;
-    if (!getline(file, line)) {  // read the header line
-        cerr << "Failed to read header line from the file." << endl;
-        return flights;  // return an empty vector if header cannot be read
+    ~ExternalMergeSorter() {
+        readers.clear();  // close the spill files before deleting them
+        for (const string& path : runPaths) {
+            remove(path.c_str());
+        }
     }
 
-    char comma = ',';  // default delimiter is a comma
-    if (line.find('\t') != string::npos) {
-        comma = '\t';  // if tab is found, change delimiter to tab
+    // Adds a record; returns false if a full buffer could not be spilled
+    bool add(const Record& record) {
+        if (buffer.size() == runCapacity && !spillRun()) return false;
+        buffer.push_back(record);
+        return true;
     }
 
-    vector<string> headers = parseCSVLine(line, comma);  // parse the header line into columns
+    // Ends the input and prepares the merge; returns false on an I/O error. With more runs than the merge
+    // fan-in, consecutive groups of runs are first merged into longer runs, keeping them in input order.
+    bool finish() {
+        if (runPaths.empty()) {  // everything fit in memory: stream the sorted buffer directly
+            if (!buffer.empty()) radixSort<Order>(buffer, 0, static_cast<int>(buffer.size()) - 1);
+            position = 0;
+            return true;
+        }
+        if (!buffer.empty() && !spillRun()) return false;
+        vector<Record>().swap(buffer);  // the run buffer's memory goes to the read buffers
 
-    cout << "Headers:" << endl;
-    for (size_t i = 0; i < headers.size(); ++i) {  // output the headers for debugging
-        cout << i << ": '" << headers[i] << "'" << endl;
+        while (runPaths.size() > EXTERNAL_SORT_MAX_FAN_IN) {
+            vector<string> mergedPaths;
+            vector<size_t> mergedSizes;
+            for (size_t first = 0; first < runPaths.size(); first += EXTERNAL_SORT_MAX_FAN_IN) {
+                size_t last = min(runPaths.size(), first + EXTERNAL_SORT_MAX_FAN_IN);
+                vector<string> group(runPaths.begin() + first, runPaths.begin() + last);
+                vector<size_t> groupSizes(runSizes.begin() + first, runSizes.begin() + last);
+                if (group.size() == 1) {
+                    mergedPaths.push_back(group[0]);
+                    mergedSizes.push_back(groupSizes[0]);
+                    continue;
+                }
+                string path = nextRunPath();
+                mergedPaths.push_back(path);
+                size_t mergedSize = 0;
+                for (size_t size : groupSizes) mergedSize += size;
+                mergedSizes.push_back(mergedSize);
+                if (!mergeGroup(group, groupSizes, path)) {
+                    runPaths.insert(runPaths.end(), mergedPaths.begin(), mergedPaths.end());  // still cleaned up
+                    return false;
+                }
+                for (const string& merged : group) {
+                    remove(merged.c_str());
+                }
+            }
+            runPaths.swap(mergedPaths);
+            runSizes.swap(mergedSizes);
+        }
+        return openRuns(runPaths, runSizes);
     }
 
-    int carrier_idx = -1, airport_name_idx = -1, arr_delay_idx = -1;
-    // find the indices of the required columns based on header names
-    for (size_t i = 0; i < headers.size(); ++i) {
-        string header_lower = headers[i];
-        transform(header_lower.begin(), header_lower.end(), header_lower.begin(), ::tolower);  // convert to lowercase
-        header_lower = trim(header_lower);
-        if (header_lower == "carrier") carrier_idx = i;
-        else if (header_lower == "airport_name") airport_name_idx = i;
-        else if (header_lower == "arr_delay") arr_delay_idx = i;
+    // Stores the next record in sorted order in record; returns false once every record was returned or
+    // when a spill file could not be read back
+    bool next(Record& record) {
+        if (readFailed) return false;
+        if (readers.empty()) {
+            if (position == buffer.size()) return false;
+            record = buffer[position++];
+            return true;
+        }
+        int winner = tree[0];
+        RunReader& run = *readers[winner];
+        if (run.exhausted()) return false;  // the best run is empty, so all of them are
+        record = run.records[run.position++];
+        if (run.position == run.filled && !run.refill()) {
+            readFailed = true;
+            return false;
+        }
+        replay(winner);
+        return true;
     }
 
-    cout << "carrier_idx: " << carrier_idx << ", airport_name_idx: " << airport_name_idx << ", arr_delay_idx: " << arr_delay_idx << endl;
+    // Number of run files written so far, including the ones written by intermediate merge passes
+    size_t runFileCount() const { return runFiles; }
 
-    // if any required column is missing, return an empty vector
-    if (carrier_idx == -1 || airport_name_idx == -1 || arr_delay_idx == -1) {
-        cerr << "Required columns not found in the CSV file." << endl;
-        return flights;
+private:
+    // One spilled run being read back in large sequential blocks
+    struct RunReader {
+        RunReader(const string& path, size_t runSize, size_t capacity)
+            : path(path), file(path, ios::binary), records(capacity), unread(runSize) {}
+
+        // Reads the next block of the run, leaving filled at 0 at its end; returns false if the file
+        // failed or held fewer records than were written to it
+        bool refill() {
+            size_t wanted = min(records.size(), unread);
+            file.read(reinterpret_cast<char*>(records.data()), wanted * sizeof(Record));
+            filled = static_cast<size_t>(file.gcount()) / sizeof(Record);
+            position = 0;
+            unread -= filled;
+            if (file.bad() || filled != wanted) {
+                cerr << "Failed to read sort run: " << path << endl;
+                return false;
+            }
+            return true;
+        }
+
+        bool exhausted() const { return position == filled; }
+
+        string path;
+        ifstream file;
+        vector<Record> records;  // read buffer
+        size_t position = 0;     // next record in the buffer
+        size_t filled = 0;       // records in the buffer
+        size_t unread;           // records of the run not read from the file yet
+    };
+
+    // Function to return the path of a new spill file
+    string nextRunPath() { return directory + "/" + filePrefix + to_string(runFiles++) + ".tmp"; }
+
+    // Function to sort the buffer and write it out as the next run
+    bool spillRun() {
+        radixSort<Order>(buffer, 0, static_cast<int>(buffer.size()) - 1);
+        string path = nextRunPath();
+        runPaths.push_back(path);
+        runSizes.push_back(buffer.size());
+        ofstream out(path, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(Record));  // one sequential write
+        out.close();
+        if (!out) {
+            cerr << "Failed to write sort run: " << path << endl;
+            return false;
+        }
+        buffer.clear();
+        return true;
+    }
+
+    // Function to open readers on the given runs, splitting the memory budget between their buffers, and
+    // build the loser tree over their first records
+    bool openRuns(const vector<string>& paths, const vector<size_t>& sizes) {
+        size_t readRecords = max(EXTERNAL_SORT_MIN_READ_RECORDS, memoryBytes / (sizeof(Record) * (paths.size() + 1)));
+        readers.clear();
+        for (size_t i = 0; i < paths.size(); ++i) {
+            readers.emplace_back(new RunReader(paths[i], sizes[i], readRecords));
+            ifstream& file = readers.back()->file;
+            if (!file.is_open()) {
+                cerr << "Failed to open sort run: " << paths[i] << endl;
+                return false;
+            }
+            // Check the file holds every record written to it so a truncated run fails here, before
+            // any record is handed out
+            file.seekg(0, ios::end);
+            bool complete = file.tellg() == static_cast<streamoff>(sizes[i] * sizeof(Record));
+            file.seekg(0, ios::beg);
+            if (!complete) {
+                cerr << "Sort run is truncated: " << paths[i] << endl;
+                return false;
+            }
+            if (!readers.back()->refill()) return false;
+        }
+        buildLoserTree();
+        return true;
     }
 
-    while (getline(file, line)) {  // read flight data lines
-        if (line.empty()) continue;  // skip empty lines
+    // Function to merge a group of runs into one new run at path
+    bool mergeGroup(const vector<string>& group, const vector<size_t>& sizes, const string& path) {
+        if (!openRuns(group, sizes)) return false;
+        size_t writeRecords = max(EXTERNAL_SORT_MIN_READ_RECORDS, memoryBytes / (sizeof(Record) * (group.size() + 1)));
+        vector<Record> output;
+        output.reserve(writeRecords);
+        ofstream out(path, ios::binary | ios::trunc);
+        Record record;
+        while (next(record)) {
+            output.push_back(record);
+            if (output.size() == writeRecords) {
+                out.write(reinterpret_cast<const char*>(output.data()), output.size() * sizeof(Record));
+                output.clear();
+            }
+        }
+        out.write(reinterpret_cast<const char*>(output.data()), output.size() * sizeof(Record));
+        out.close();
+        readers.clear();
+        if (readFailed) return false;
+        if (!out) {
+            cerr << "Failed to write sort run: " << path << endl;
+            return false;
+        }
+        return true;
+    }
 
-        vector<string> tokens = parseCSVLine(line, comma);  // parse the line into tokens
+    // Returns true if run a's head goes before run b's head; empty runs go last and ties to the earlier run
+    bool headBefore(int a, int b) const {
+        const RunReader& first = *readers[a];
+        const RunReader& second = *readers[b];
+        if (first.exhausted()) return false;
+        if (second.exhausted()) return true;
+        auto firstKey = orderKey<Order>(first.records[first.position]);
+        auto secondKey = orderKey<Order>(second.records[second.position]);
+        if (firstKey != secondKey) return firstKey < secondKey;
+        return a < b;
+    }
 
-        if (tokens.size() <= max({carrier_idx, airport_name_idx, arr_delay_idx})) {  // skip invalid lines
-            continue;
+    // Builds the loser tree over the run heads: leaf i sits at node k + i, every inner node keeps the loser
+    // of the match between its children, and tree[0] the overall winner
+    void buildLoserTree() {
+        int k = static_cast<int>(readers.size());
+        tree.assign(k, 0);
+        vector<int> winners(2 * k);
+        for (int i = 0; i < k; ++i) {
+            winners[k + i] = i;
+        }
+        for (int node = k - 1; node >= 1; --node) {
+            int left = winners[2 * node], right = winners[2 * node + 1];
+            bool leftWins = headBefore(left, right) || !headBefore(right, left);
+            winners[node] = leftWins ? left : right;
+            tree[node] = leftWins ? right : left;
         }
+        tree[0] = k > 1 ? winners[1] : 0;
+    }
 
-        Flight flight;
-        flight.carrier = tokens[carrier_idx];  // store the carrier code
-        flight.airport_name = tokens[airport_name_idx];  // store the airport name
+    // Replays the matches from run's leaf to the root after its head changed: one comparison per level
+    void replay(int run) {
+        int winner = run;
+        for (int node = (run + static_cast<int>(readers.size())) / 2; node >= 1; node /= 2) {
+            if (headBefore(tree[node], winner)) swap(tree[node], winner);
+        }
+        tree[0] = winner;
+    }
+
+    size_t memoryBytes;
+    string directory;                      // where the spill files go
+    string filePrefix;                     // unique to this sorter, so runs of concurrent sorts do not collide
+    size_t runCapacity;                    // records per run
+    vector<Record> buffer;                 // records of the run being filled, or of the whole input if it fit
+    size_t position = 0;                   // next record of buffer to stream when nothing was spilled
+    size_t runFiles = 0;                   // spill files created so far
+    vector<string> runPaths;               // spill files of the current runs, in input order
+    vector<size_t> runSizes;               // records in each of runPaths
+    bool readFailed = false;               // a spill file could not be read back during the merge
+    vector<unique_ptr<RunReader>> readers; // one per run during the merge
+    vector<int> tree;                      // loser tree over the runs; tree[0] is the current winner
+};
+
+// External merge sort of flights between indices low and high within a memory budget, through spill
+// files in directory. This is the benchmark path for the sort menu: the records already sit in the vector
+// and are streamed back into it, so it times the spill and merge I/O rather than saving memory. Code with
+// input that does not fit in memory feeds an ExternalMergeSorter and reads next() directly. Returns false
+// on an I/O error; the number of spill files written is stored in runFilesOut if given. A read error while
+// the records are streamed back leaves [low, high] partly overwritten.
+template <typename Order = ArrivalDelayOrder, typename Record>
+bool externalMergeSort(vector<Record>& flights, int low, int high, size_t memoryBytes, const string& directory,
+                       size_t* runFilesOut = nullptr) {
+    if (runFilesOut != nullptr) *runFilesOut = 0;
+    if (low >= high) return true;
+    ExternalMergeSorter<Order, Record> sorter(memoryBytes, directory);
+    for (int i = low; i <= high; ++i) {
+        if (!sorter.add(flights[i])) return false;
+    }
+    if (!sorter.finish()) return false;
+    for (int i = low; i <= high; ++i) {
+        if (!sorter.next(flights[i])) return false;
+    }
+    if (runFilesOut != nullptr) *runFilesOut = sorter.runFileCount();
+    return true;
+}
 
-        try {
-            flight.arr_delay = static_cast<int>(stod(tokens[arr_delay_idx]));  // parse the arrival delay as an integer
-        } catch (const invalid_argument& e) {
-            continue;  // skip lines with invalid delay values
+// Function to move the record a full sort would put at index nth of [low, high] into place, with no
+// greater keys before it and no smaller keys after it. Introselect: quickselect on three-way partitions
+// around sampled pivots that only follows the side holding nth, switching to heapsort of what is left
+// after 2*log2(n) partitions so bad pivots cannot make it quadratic.
+template <typename Order = ArrivalDelayOrder, typename Record>
+void introSelect(vector<Record>& flights, int low, int high, int nth) {
+    int depthLimit = 0;
+    for (int n = high - low + 1; n > 1; n >>= 1) {
+        depthLimit += 2;
+    }
+    PivotRandom random(QUICK_SORT_SEED);
+    while (high - low + 1 > smallSortCutoff(flights.data())) {
+        if (depthLimit-- == 0) {
+            heapSort<Order>(flights, low, high);
+            return;
+        }
+        pair<int, int> equal = threeWayPartition<Order>(flights, low, high, randomPivotKey<Order>(flights, low, high, random));
+        if (nth < equal.first) {
+            high = equal.first - 1;
+        } else if (nth > equal.second) {
+            low = equal.second + 1;
+        } else {
+            return;  // nth is one of the keys equal to the pivot
         }
-        flights.push_back(flight);  // add the flight to the list
     }
+    if (low < high) smallSort<Order>(&flights[low], high - low + 1);
+}
 
-    file.close();  // close the file
-    return flights;  // return the list of flights
+// Function to return the index a full sort of n records puts percentile p (0 to 100) at, by the
+// nearest-rank method: the smallest record with at least p percent of the records at or below it
+inline size_t percentileRank(size_t n, double percent) {
+    if (n == 0 || percent <= 0) return 0;
+    double rank = ceil(percent / 100.0 * n);
+    return rank >= n ? n - 1 : static_cast<size_t>(rank) - 1;
 }
 
-// QuickSort function to sort the flights based on their arrival delay
-void quickSort(vector<Flight>& flights, int low, int high) {
-    if (low < high) {
-        // Randomly select a pivot index and swap it to the end
-        int pivotIndex = low + rand() % (high - low + 1);
-        swap(flights[pivotIndex], flights[high]);
+// Function to return the records at the given percentiles, in the order asked, as a full sort would
+// place them. Ranks are selected smallest first, each selection narrowing the range left for the next.
+template <typename Order = ArrivalDelayOrder, typename Record>
+vector<Record> selectPercentiles(vector<Record> flights, const vector<double>& percents) {
+    vector<Record> selected;
+    if (flights.empty()) return selected;
+    vector<pair<size_t, size_t>> ranks;  // (rank, position in percents)
+    for (size_t i = 0; i < percents.size(); ++i) {
+        ranks.push_back(make_pair(percentileRank(flights.size(), percents[i]), i));
+    }
+    sort(ranks.begin(), ranks.end());
 
-        int pivot = flights[high].arr_delay;  // pivot value is the arrival delay
-        int i = low - 1;
-        for (int j = low; j < high; ++j) {
-            if (flights[j].arr_delay <= pivot) {
-                ++i;
-                swap(flights[i], flights[j]);  // swap to arrange smaller values before pivot
-            }
+    selected.resize(percents.size());
+    int low = 0, high = static_cast<int>(flights.size()) - 1;
+    for (const pair<size_t, size_t>& rank : ranks) {
+        int nth = static_cast<int>(rank.first);
+        if (nth >= low) {  // a repeated rank is already in place
+            introSelect<Order>(flights, low, high, nth);
+            low = nth + 1;
         }
-        swap(flights[i + 1], flights[high]);  // place pivot in its correct position
-        int pi = i + 1;
+        selected[rank.second] = flights[nth];
+    }
+    return selected;
+}
 
-        quickSort(flights, low, pi - 1);  // recursively sort the left partition
-        quickSort(flights, pi + 1, high);  // recursively sort the right partition
+// Function to return the records with the k largest keys, largest first, using a bounded min-heap of
+// k entries. Ties are broken by position the way a stable sort breaks them, so the result is the last
+// k records of a stable ascending sort, reversed.
+template <typename Order = ArrivalDelayOrder, typename Record>
+vector<Record> topRecords(const vector<Record>& flights, size_t k) {
+    typedef decltype(orderKey<Order>(flights[0])) Key;
+    typedef pair<Key, size_t> Entry;  // (key, position)
+    k = min(k, flights.size());
+    vector<Entry> heap;  // min-heap: heap.front() is the smallest of the best k so far
+    heap.reserve(k);
+    auto greaterEntry = [](const Entry& a, const Entry& b) { return a > b; };
+    for (size_t i = 0; i < flights.size() && k > 0; ++i) {
+        Entry entry(orderKey<Order>(flights[i]), i);
+        if (heap.size() < k) {
+            heap.push_back(entry);
+            push_heap(heap.begin(), heap.end(), greaterEntry);
+        } else if (heap.front() < entry) {  // beats the smallest kept entry
+            pop_heap(heap.begin(), heap.end(), greaterEntry);
+            heap.back() = entry;
+            push_heap(heap.begin(), heap.end(), greaterEntry);
+        }
     }
+    sort_heap(heap.begin(), heap.end(), greaterEntry);  // largest first
+    vector<Record> top;
+    for (const Entry& entry : heap) {
+        top.push_back(flights[entry.second]);
+    }
+    return top;
 }
 
-// Placeholder for merge sort implementation
-void mergeSort(vector<Flight>& flights, int left, int right) {
-    // FIXME: implement merge sort here
-    // function should sort the flights vector between indices left and right
-    // based on arr_delay using the merge sort algorithm. make sure to check out comments in int main as well
+// Function to return the records a stable sort would put first and last, in one pass over a non-empty range
+template <typename Order = ArrivalDelayOrder, typename Record>
+pair<Record, Record> minMaxRecords(const vector<Record>& flights) {
+    size_t lowest = 0, highest = 0;
+    for (size_t i = 1; i < flights.size(); ++i) {
+        if (orderKey<Order>(flights[i]) < orderKey<Order>(flights[lowest])) lowest = i;    // first of the smallest
+        if (!(orderKey<Order>(flights[i]) < orderKey<Order>(flights[highest]))) highest = i;  // last of the largest
+    }
+    return make_pair(flights[lowest], flights[highest]);
 }
 
 // Function to return the best case (already sorted data)
-vector<Flight> getBestCase(const vector<Flight>& flights) {
-    vector<Flight> sortedFlights = flights;
-    sort(sortedFlights.begin(), sortedFlights.end(), [](const Flight& a, const Flight& b) {
-        return a.arr_delay < b.arr_delay;  // sort by ascending arrival delay
+template <typename Order = ArrivalDelayOrder, typename Record>
+vector<Record> getBestCase(const vector<Record>& flights) {
+    vector<Record> sortedFlights = flights;
+    sort(sortedFlights.begin(), sortedFlights.end(), [](const Record& a, const Record& b) {
+        return orderKey<Order>(a) < orderKey<Order>(b);  // sort in ascending order
     });
     return sortedFlights;
 }
 
 // Function to return the worst case (reverse sorted data)
-vector<Flight> getWorstCase(const vector<Flight>& flights) {
-    vector<Flight> sortedFlights = flights;
-    sort(sortedFlights.begin(), sortedFlights.end(), [](const Flight& a, const Flight& b) {
-        return a.arr_delay > b.arr_delay;  // sort by descending arrival delay
+template <typename Order = ArrivalDelayOrder, typename Record>
+vector<Record> getWorstCase(const vector<Record>& flights) {
+    vector<Record> sortedFlights = flights;
+    sort(sortedFlights.begin(), sortedFlights.end(), [](const Record& a, const Record& b) {
+        return orderKey<Order>(a) > orderKey<Order>(b);  // sort in descending order
     });
     return sortedFlights;
 }
 
 // Function to return the average case (shuffled data)
-vector<Flight> getAverageCase(const vector<Flight>& flights) {
-    vector<Flight> shuffledFlights = flights;
+template <typename Record>
+vector<Record> getAverageCase(const vector<Record>& flights) {
+    vector<Record> shuffledFlights = flights;
     random_shuffle(shuffledFlights.begin(), shuffledFlights.end());  // shuffle the data
     return shuffledFlights;
 }
 
-int main() {
+// Options controlling how the sorting methods run
+struct SortOptions {
+    unsigned threads = 0;                  // threads for the parallel methods; 0 uses every hardware thread
+    size_t memoryBytes = size_t(64) << 20; // memory budget of the external merge sort
+    string spillDirectory = ".";           // where the external merge sort writes its runs
+};
+
+// Sorting methods offered in the menu, numbered as the user enters them
+enum SortMethod {
+    QUICK_SORT = 1,
+    MERGE_SORT,
+    RADIX_SORT,
+    PARALLEL_QUICK_SORT,
+    PDQ_SORT,
+    TIM_SORT,
+    COUNTING_SORT,
+    EXTERNAL_MERGE_SORT,
+    SAMPLE_SORT,
+    AUTO_SORT,
+    SORT_METHOD_COUNT = AUTO_SORT  // highest menu number
+};
+
+// Function to return the name of a sorting method as shown in the menu
+const char* sortMethodName(int sortingMethod) {
+    switch (sortingMethod) {
+        case QUICK_SORT: return "Quick Sort";
+        case MERGE_SORT: return "Merge Sort";
+        case RADIX_SORT: return "Radix Sort (LSD)";
+        case PARALLEL_QUICK_SORT: return "Parallel Quick Sort (work stealing)";
+        case PDQ_SORT: return "Pattern-Defeating Quick Sort (branchless blocks)";
+        case TIM_SORT: return "Tim Sort (natural runs, galloping merges)";
+        case COUNTING_SORT: return "Counting Sort (delay histogram)";
+        case EXTERNAL_MERGE_SORT: return "External Merge Sort (spilled runs, loser tree)";
+        case SAMPLE_SORT: return "Parallel Sample Sort (splitter tree buckets)";
+        case AUTO_SORT: return "Auto (picks a method from the input)";
+        default: return "Unknown";
+    }
+}
+
+// Number of positions sampled for the inversion and duplicate estimates of the auto sort
+const size_t SORT_PROFILE_SAMPLES = 1024;
+
+// Presortedness of an input, measured by the auto sort before it picks a method
+struct SortProfile {
+    size_t records = 0;
+    size_t runs = 0;              // natural runs as Tim Sort sees them: ascending, or descending with ties
+    double inversionRatio = 0;    // share of sampled pairs (i < j) whose keys are out of order
+    uint64_t keyRange = 0;        // largest minus smallest counting-sort key
+    double duplicateRatio = 0;    // share of sampled keys equal to another sampled key
+};
+
+// Function to measure an input: one pass for the runs and the key range, plus fixed-size random samples
+// for the inversion and duplicate estimates
+template <typename Order, typename Record>
+SortProfile profileSortInput(const vector<Record>& data) {
+    SortProfile profile;
+    size_t n = data.size();
+    profile.records = n;
+    if (n < 2) {
+        profile.runs = n;
+        return profile;
+    }
+
+    uint64_t lowest = histogramKey<Order>(data[0]), highest = lowest;
+    profile.runs = 1;
+    int direction = 0;  // 0 while the current run has one record, then 1 ascending or -1 descending
+    for (size_t i = 1; i < n; ++i) {
+        uint64_t key = histogramKey<Order>(data[i]);
+        lowest = min(lowest, key);
+        highest = max(highest, key);
+        bool descends = orderKey<Order>(data[i]) < orderKey<Order>(data[i - 1]);
+        bool ascends = orderKey<Order>(data[i - 1]) < orderKey<Order>(data[i]);
+        if (direction == 0) {
+            direction = descends ? -1 : 1;  // a tie after the first record starts an ascending run
+        } else if (direction == 1 ? descends : ascends) {
+            ++profile.runs;  // the run ends here; this record starts the next one
+            direction = 0;
+        }
+    }
+    profile.keyRange = highest - lowest;
+
+    PivotRandom random(QUICK_SORT_SEED);
+    size_t inverted = 0;
+    for (size_t sample = 0; sample < SORT_PROFILE_SAMPLES; ++sample) {
+        int a = random.between(0, static_cast<int>(n) - 1), b = random.between(0, static_cast<int>(n) - 1);
+        if (a == b) continue;
+        if (a > b) swap(a, b);
+        if (orderKey<Order>(data[b]) < orderKey<Order>(data[a])) ++inverted;
+    }
+    profile.inversionRatio = static_cast<double>(inverted) / SORT_PROFILE_SAMPLES;
+
+    vector<uint64_t> sampled;
+    size_t sampleCount = min(n, SORT_PROFILE_SAMPLES);
+    for (size_t sample = 0; sample < sampleCount; ++sample) {
+        sampled.push_back(orderKey<Order>(data[sampleCount == n ? sample : random.between(0, static_cast<int>(n) - 1)]));
+    }
+    sort(sampled.begin(), sampled.end());
+    size_t duplicates = 0;
+    for (size_t i = 0; i < sampled.size(); ++i) {
+        if ((i > 0 && sampled[i] == sampled[i - 1]) || (i + 1 < sampled.size() && sampled[i] == sampled[i + 1])) {
+            ++duplicates;
+        }
+    }
+    profile.duplicateRatio = static_cast<double>(duplicates) / sampled.size();
+    return profile;
+}
+
+// Function to pick the sorting method for a measured input, and say why in reason. The rules go from
+// the most to the least specific input shape. The external merge sort is never picked: the input is
+// already in memory, so spilling it would only add disk traffic.
+int chooseSortMethod(const SortProfile& profile, const SortOptions& options, string& reason) {
+    unsigned threads = options.threads == 0 ? max(1u, thread::hardware_concurrency()) : options.threads;
+    size_t n = profile.records;
+    if (n <= static_cast<size_t>(SORTING_NETWORK_CUTOFF)) {
+        reason = "small input";
+        return QUICK_SORT;
+    }
+    if (profile.runs * TIM_SORT_MIN_MERGE <= n) {
+        reason = "long natural runs";
+        return TIM_SORT;
+    }
+    if (profile.keyRange < COUNTING_SORT_RANGE_FACTOR * n) {
+        reason = "narrow key range";
+        return COUNTING_SORT;
+    }
+    if (profile.inversionRatio <= 0.01) {
+        reason = "nearly sorted";
+        return PDQ_SORT;
+    }
+    if (threads > 1 && n >= static_cast<size_t>(PARALLEL_PARTITION_CUTOFF)) {
+        reason = "large input and several threads";
+        return PARALLEL_QUICK_SORT;
+    }
+    if (profile.duplicateRatio >= 0.5) {
+        reason = "many duplicate keys";
+        return QUICK_SORT;
+    }
+    if (n >= (size_t(1) << 16)) {
+        reason = "large input with wide keys";
+        return RADIX_SORT;
+    }
+    reason = "no special structure";
+    return PDQ_SORT;
+}
+
+// Function to sort records with the method picked in the menu
+template <typename Order, typename Record>
+void sortWithMethod(vector<Record>& data, int sortingMethod, const SortOptions& options) {
+    switch (sortingMethod) {
+        case QUICK_SORT:
+            quickSort<Order>(data, 0, data.size() - 1);  // perform quick sort
+            break;
+        case MERGE_SORT:
+            mergeSort<Order>(data, 0, data.size() - 1, options.threads);
+            break;
+        case RADIX_SORT:
+            radixSort<Order>(data, 0, data.size() - 1);
+            break;
+        case PARALLEL_QUICK_SORT:
+            parallelQuickSort<Order>(data, 0, data.size() - 1, options.threads);
+            break;
+        case PDQ_SORT:
+            pdqSort<Order>(data, 0, data.size() - 1);
+            break;
+        case TIM_SORT:
+            timSort<Order>(data, 0, data.size() - 1);
+            break;
+        case COUNTING_SORT:
+            countingSort<Order>(data, 0, data.size() - 1);
+            break;
+        case EXTERNAL_MERGE_SORT: {
+            size_t runFiles = 0;
+            if (!externalMergeSort<Order>(data, 0, data.size() - 1, options.memoryBytes, options.spillDirectory, &runFiles)) {
+                cerr << "External merge sort failed; sorting in memory instead." << endl;
+                mergeSort<Order>(data, 0, data.size() - 1, options.threads);
+                break;
+            }
+            cout << "External merge sort: " << runFiles << " run files" << endl;
+            break;
+        }
+        case SAMPLE_SORT: {
+            SampleSortStats stats;
+            sampleSort<Order>(data, 0, data.size() - 1, options.threads, &stats);
+            cout << "Sample sort: " << stats.buckets << " buckets of " << stats.smallestBucket << " to "
+                 << stats.largestBucket << " records, imbalance " << stats.imbalance << "x" << endl;
+            break;
+        }
+        case AUTO_SORT: {
+            SortProfile profile = profileSortInput<Order>(data);
+            string reason;
+            int chosen = chooseSortMethod(profile, options, reason);
+            cout << "Auto sort: records=" << profile.records << " runs=" << profile.runs
+                 << " inversions=" << profile.inversionRatio << " key range=" << profile.keyRange
+                 << " duplicates=" << profile.duplicateRatio << " -> " << sortMethodName(chosen) << " (" << reason << ")"
+                 << endl;
+            sortWithMethod<Order>(data, chosen, options);
+            break;
+        }
+    }
+}
+
+// Function to describe a flight as carrier, airport and arrival delay
+string describeFlight(const FlightTable& flights, const Flight& flight) {
+    return flights.carriers.name(flight.carrier_id) + " at " + flights.airports.name(flight.airport_id) + ", " +
+           to_string(flight.arr_delay) + " minutes";
+}
+
+// Function to time one sorting run and display the shortest and longest delay of the result (or, under
+// other orders, the first and last flight)
+template <typename Order, typename Record>
+void timeSortCase(const string& label, vector<Record> data, int sortingMethod, const SortOptions& options,
+                  const FlightTable& flights) {
+    auto start = high_resolution_clock::now();  // start timing
+    sortWithMethod<Order>(data, sortingMethod, options);
+    auto end = high_resolution_clock::now();  // end timing
+    auto elapsed = duration<double, milli>(end - start);
+    cout << "\n" << label << " Sorting Time: " << elapsed.count() << " ms" << endl;
+
+    if (data.empty()) return;
+    // only the two records displayed are materialized
+    if (is_same<Order, ArrivalDelayOrder>::value) {
+        cout << "Shortest delay: " << recordFlight(flights, data.front()).arr_delay << " minutes" << endl;  // display shortest delay
+        cout << "Longest delay: " << recordFlight(flights, data.back()).arr_delay << " minutes" << endl;  // display longest delay
+    } else {
+        cout << "First flight: " << describeFlight(flights, recordFlight(flights, data.front())) << endl;
+        cout << "Last flight: " << describeFlight(flights, recordFlight(flights, data.back())) << endl;
+    }
+}
+
+// Function to run the best, worst and average case timings on one selection
+template <typename Order, typename Record>
+void runSortCases(const vector<Record>& selected, int sortingMethod, const SortOptions& options,
+                  const FlightTable& flights) {
+    cout << fixed << setprecision(2);  // format the output to 2 decimal places
+    timeSortCase<Order>("Best Case (Already Sorted)", getBestCase<Order>(selected), sortingMethod, options, flights);
+    timeSortCase<Order>("Worst Case (Reverse Sorted)", getWorstCase<Order>(selected), sortingMethod, options, flights);
+    timeSortCase<Order>("Average Case (Random Order)", getAverageCase(selected), sortingMethod, options, flights);
+}
+
+// Function to run the sort cases on the selected rows in the chosen layout. Packed keys hold the order's
+// key next to the row id in 64 bits, so orders with wider keys always sort Flight records.
+template <typename Order>
+void runSelection(const FlightTable& flights, const vector<uint32_t>& rows, int layoutChoice, int sortingMethod,
+                  const SortOptions& options) {
+    bool packable = sizeof(decltype(Order::key(Flight()))) <= sizeof(uint32_t);
+    if (layoutChoice == 2 && packable) {
+        runSortCases<Order>(buildSortKeys<Order>(flights, rows), sortingMethod, options, flights);
+        return;
+    }
+    if (layoutChoice == 2) {
+        cout << "This order's key does not fit next to a row id; sorting Flight records instead.\n";
+    }
+    runSortCases<Order>(gatherFlights(flights, rows), sortingMethod, options, flights);
+}
+
+// Number of largest delays listed by the selection report
+const size_t TOP_DELAYS_SHOWN = 10;
+
+// Function to report the delay extremes, percentiles and largest delays of the selected rows without
+// sorting them: one pass for the extremes, introselect for the percentiles and a bounded heap for the
+// largest delays. The (delay, row id) keys are unique, so the answers match a full sort exactly.
+void reportDelaySelection(const FlightTable& flights, const vector<uint32_t>& rows) {
+    if (rows.empty()) return;
+    vector<uint64_t> keys = buildSortKeys(flights, rows);
+    const vector<double> percents = {50, 95, 99};
+
+    auto start = high_resolution_clock::now();
+    pair<uint64_t, uint64_t> extremes = minMaxRecords(keys);
+    vector<uint64_t> percentiles = selectPercentiles(keys, percents);
+    vector<uint64_t> largest = topRecords(keys, TOP_DELAYS_SHOWN);
+    auto end = high_resolution_clock::now();
+
+    cout << "\nDelay Selection Time (no sort): " << duration<double, milli>(end - start).count() << " ms" << endl;
+    cout << "Shortest delay: " << sortKeyDelay(extremes.first) << " minutes" << endl;
+    cout << "Longest delay: " << sortKeyDelay(extremes.second) << " minutes" << endl;
+    for (size_t i = 0; i < percents.size(); ++i) {
+        cout << "p" << static_cast<int>(percents[i]) << " delay: " << sortKeyDelay(percentiles[i]) << " minutes" << endl;
+    }
+    cout << "Largest delays:" << endl;
+    for (uint64_t key : largest) {
+        cout << "  " << describeFlight(flights, recordFlight(flights, key)) << endl;
+    }
+}
+
+// Function to report a filtered selection straight from a delay partition: the rows of one carrier or
+// airport are already in arr_delay order, so the sorted selection is a slice and needs no sort
+void reportDelayPartition(const FlightTable& flights, const RowIndex& partitions, size_t id) {
+    if (partitions.count(id) == 0) return;
+    auto start = high_resolution_clock::now();
+    vector<uint32_t> sortedRows(partitions.begin(id), partitions.end(id));
+    auto end = high_resolution_clock::now();
+
+    size_t n = sortedRows.size();
+    cout << "\nPresorted Partition Slice Time (no sort): " << duration<double, milli>(end - start).count() << " ms" << endl;
+    cout << "Shortest delay: " << flights.arr_delay[sortedRows.front()] << " minutes" << endl;
+    cout << "Longest delay: " << flights.arr_delay[sortedRows.back()] << " minutes" << endl;
+    cout << "p50 delay: " << flights.arr_delay[sortedRows[percentileRank(n, 50)]] << " minutes" << endl;
+}
+
+int main(int argc, char* argv[]) {
     string filename = "Airline_Delay_Cause.csv";  // input CSV file name
-    vector<Flight> flights = readFlightData(filename);  // read flight data from the file
+    IngestOptions ingestOptions;
+    SortOptions sortOptions;
+    int scale = 1;               // number of copies of the selection to sort, to time larger inputs
+    string sortOrder = "delay";  // order policy the flights are sorted by
+
+    // Command line flags select how the CSV file is loaded and sorted
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--no-mmap") {
+            ingestOptions.useMemoryMap = false;  // read the file through a stream instead of mapping it
+        } else if (arg == "--snapshot") {
+            ingestOptions.useSnapshot = true;  // reuse or build the binary snapshot next to the CSV file
+        } else if (arg == "--presort") {
+            ingestOptions.presort = true;  // order each carrier's and airport's rows by arr_delay at load time
+        } else if (arg == "--threads" && i + 1 < argc) {
+            ingestOptions.threads = static_cast<unsigned>(max(0, atoi(argv[++i])));  // parser thread count
+        } else if (arg == "--sort-threads" && i + 1 < argc) {
+            sortOptions.threads = static_cast<unsigned>(max(0, atoi(argv[++i])));  // parallel sort thread count
+        } else if (arg == "--sort-memory" && i + 1 < argc) {
+            sortOptions.memoryBytes = static_cast<size_t>(max(1, atoi(argv[++i]))) << 20;  // external sort budget in MB
+        } else if (arg == "--spill-dir" && i + 1 < argc) {
+            sortOptions.spillDirectory = argv[++i];  // directory for the external sort's run files
+        } else if (arg == "--order" && i + 1 < argc) {
+            sortOrder = argv[++i];  // delay, delay-desc, airport-delay or carrier-airport-delay
+            if (sortOrder != "delay" && sortOrder != "delay-desc" && sortOrder != "airport-delay" &&
+                sortOrder != "carrier-airport-delay") {
+                cerr << "Unknown sort order: " << sortOrder << endl;
+                return 1;
+            }
+        } else if (arg == "--scale" && i + 1 < argc) {
+            scale = max(1, atoi(argv[++i]));  // repeat the selection to build a larger input
+        } else {
+            filename = arg;  // any other argument names the input CSV file
+        }
+    }
+
+    FlightTable flights = readFlightData(filename, ingestOptions);  // read flight data from the file
 
     if (flights.empty()) {  // if no data is read, terminate
         cerr << "No data to sort." << endl;
         return 1;
     }
 
-    set<string> validCarriers;  // set to store valid airline carriers
-    for (const auto& flight : flights) {
-        validCarriers.insert(flight.carrier);  // add unique carriers to the set
-    }
-
     int sortingMethod = 0;
     cout << "Select the sorting method to test:\n";
-    cout << "1. Quick Sort\n";
-    cout << "2. Merge Sort\n";
-    cout << "Enter your choice (1 or 2): ";
+    for (int method = 1; method <= SORT_METHOD_COUNT; ++method) {
+        cout << method << ". " << sortMethodName(method) << "\n";
+    }
+    cout << "Enter your choice (1-" << SORT_METHOD_COUNT << "): ";
     cin >> sortingMethod;  // user input for sorting method
 
     // Validate sorting method input
-    while (sortingMethod != 1 && sortingMethod != 2) {
-        cout << "Invalid choice. Please enter 1 or 2: ";
+    while (sortingMethod < 1 || sortingMethod > SORT_METHOD_COUNT) {
+        cout << "Invalid choice. Please enter a number from 1 to " << SORT_METHOD_COUNT << ": ";
         cin >> sortingMethod;
     }
 
+    int layoutChoice = 0;
+    cout << "Select what to sort:\n";
+    cout << "1. Flight records\n";
+    cout << "2. (delay, row id) keys, looking up records afterwards\n";
+    cout << "Enter your choice (1 or 2): ";
+    cin >> layoutChoice;  // user input for sort layout
+
+    // Validate sort layout input
+    while (layoutChoice != 1 && layoutChoice != 2) {
+        cout << "Invalid choice. Please enter 1 or 2: ";
+        cin >> layoutChoice;
+    }
+
     int filterChoice = 0;
     cout << "Do you want to sort delays specific to:\n";
     cout << "1. An airline carrier\n";
@@ -221,7 +3928,9 @@ int main() {
         cin >> filterChoice;
     }
 
-    vector<Flight> selectedFlights;
+    vector<uint32_t> selectedRows;  // table rows of the selected flights
+    const RowIndex* partitions = nullptr;  // delay partitions holding the selection as one id, if any
+    size_t partitionId = 0;
 
     // Filter the flights based on the user's choice (airline or airport)
     if (filterChoice == 1) {
@@ -229,19 +3938,19 @@ int main() {
         cout << "Enter the airline carrier code (e.g., AA, DL, UA): ";
         cin >> airlineName;
 
-        // Validate airline carrier code input
-        while (validCarriers.find(airlineName) == validCarriers.end()) {
+        // Validate airline carrier code input against the carrier dictionary
+        int carrierId = flights.carriers.find(airlineName);
+        while (carrierId < 0) {
             cout << "Invalid airline carrier code. Please enter a valid airline code: ";
             cin >> airlineName;
+            carrierId = flights.carriers.find(airlineName);
         }
 
-        for (const auto& flight : flights) {
-            if (flight.carrier == airlineName) {  // add flights that match the carrier
-                selectedFlights.push_back(flight);
-            }
-        }
+        selectedRows.assign(flights.carrierRows.begin(carrierId), flights.carrierRows.end(carrierId));  // rows of the carrier
+        partitions = &flights.carrierRowsByDelay;
+        partitionId = carrierId;
 
-        if (selectedFlights.empty()) {
+        if (selectedRows.empty()) {
             cout << "No flights found for the airline: " << airlineName << endl;
             return 1;
         }
@@ -251,92 +3960,66 @@ int main() {
         cin.ignore();
         getline(cin, airportName);  // allow input with spaces
 
-        // Convert the airport name to lowercase for case-insensitive comparison
-        string airportNameLower = airportName;
-        transform(airportNameLower.begin(), airportNameLower.end(), airportNameLower.begin(), ::tolower);
-
-        for (const auto& flight : flights) {
-            string flightAirportNameLower = flight.airport_name;
-            transform(flightAirportNameLower.begin(), flightAirportNameLower.end(), flightAirportNameLower.begin(), ::tolower);
+        vector<uint16_t> airportIds = findAirportRows(flights, airportName, selectedRows);  // match the names once, read rows from the index
+        if (airportIds.size() == 1) {
+            partitions = &flights.airportRowsByDelay;
+            partitionId = airportIds[0];
+        }
 
-            if (flightAirportNameLower.find(airportNameLower) != string::npos) {  // if airport matches
-                selectedFlights.push_back(flight);
+        // Offer the closest airport names when no name contains the text, e.g. for a misspelled city
+        if (selectedRows.empty()) {
+            vector<uint16_t> suggestions =
+                flights.airportGrams.findSimilar(airportName, AIRPORT_SUGGESTIONS, TRIGRAM_MIN_SIMILARITY);
+            if (!suggestions.empty()) {
+                cout << "No airport name contains: " << airportName << ". Did you mean:\n";
+                for (size_t i = 0; i < suggestions.size(); ++i) {
+                    cout << i + 1 << ". " << flights.airports.name(suggestions[i]) << "\n";
+                }
+                cout << "Enter the number of an airport, or 0 to stop: ";
+                size_t suggestion = 0;
+                cin >> suggestion;
+                if (suggestion >= 1 && suggestion <= suggestions.size()) {
+                    uint16_t airportId = suggestions[suggestion - 1];
+                    selectedRows.assign(flights.airportRows.begin(airportId), flights.airportRows.end(airportId));
+                    partitions = &flights.airportRowsByDelay;
+                    partitionId = airportId;
+                }
             }
         }
 
-        if (selectedFlights.empty()) {
+        if (selectedRows.empty()) {
             cout << "No flights found for airport city containing: " << airportName << endl;
             return 1;
         }
     }
 
-    // Display sorting method chosen
-    if (sortingMethod == 1) {
-        cout << "\nYou selected Quick Sort.\n";
-    } else if (sortingMethod == 2) {
-        cout << "\nYou selected Merge Sort.\n";
-    }
-
-    cout << fixed << setprecision(2);  // format the output to 2 decimal places
-
-    // Best case sorting (already sorted data)
-    vector<Flight> bestCaseData = getBestCase(selectedFlights);
-    auto start = high_resolution_clock::now();  // start timing
-
-    if (sortingMethod == 1) {
-        quickSort(bestCaseData, 0, bestCaseData.size() - 1);  // perform quick sort
-    } else {
-        // FIXME: implement merge sort call
-        mergeSort(bestCaseData, 0, bestCaseData.size() - 1);
-    }
-
-    auto end = high_resolution_clock::now();  // end timing
-    auto durationBest = duration<double, milli>(end - start);
-    cout << "\nBest Case (Already Sorted) Sorting Time: " << durationBest.count() << " ms" << endl;
-
-    if (!bestCaseData.empty()) {
-        cout << "Shortest delay: " << bestCaseData.front().arr_delay << " minutes" << endl;  // display shortest delay
-        cout << "Longest delay: " << bestCaseData.back().arr_delay << " minutes" << endl;  // display longest delay
-    }
-
-    // Worst case sorting (reverse sorted data)
-    vector<Flight> worstCaseData = getWorstCase(selectedFlights);
-    start = high_resolution_clock::now();
-
-    if (sortingMethod == 1) {
-        quickSort(worstCaseData, 0, worstCaseData.size() - 1);
-    } else {
-        // FIXME: implement merge sort call
-        mergeSort(worstCaseData, 0, worstCaseData.size() - 1);
-    }
-
-    end = high_resolution_clock::now();
-    auto durationWorst = duration<double, milli>(end - start);
-    cout << "\nWorst Case (Reverse Sorted) Sorting Time: " << durationWorst.count() << " ms" << endl;
-
-    if (!worstCaseData.empty()) {
-        cout << "Shortest delay: " << worstCaseData.front().arr_delay << " minutes" << endl;
-        cout << "Longest delay: " << worstCaseData.back().arr_delay << " minutes" << endl;
+    // Repeat the selection to time the sorts on inputs larger than one filter returns
+    if (scale > 1) {
+        size_t selectedCount = selectedRows.size();
+        selectedRows.reserve(selectedCount * scale);
+        for (int copyIndex = 1; copyIndex < scale; ++copyIndex) {
+            for (size_t i = 0; i < selectedCount; ++i) {
+                selectedRows.push_back(selectedRows[i]);
+            }
+        }
+        cout << "Sorting " << selectedRows.size() << " flights (" << scale << " copies of the selection).\n";
     }
 
-    // Average case sorting (shuffled data)
-    vector<Flight> averageCaseData = getAverageCase(selectedFlights);
-    start = high_resolution_clock::now();
+    // Display sorting method chosen
+    cout << "\nYou selected " << sortMethodName(sortingMethod) << ".\n";
 
-    if (sortingMethod == 1) {
-        quickSort(averageCaseData, 0, averageCaseData.size() - 1);
+    if (sortOrder == "delay-desc") {
+        runSelection<Descending<ArrivalDelayOrder>>(flights, selectedRows, layoutChoice, sortingMethod, sortOptions);
+    } else if (sortOrder == "airport-delay") {
+        runSelection<ThenBy<AirportOrder, ArrivalDelayOrder>>(flights, selectedRows, layoutChoice, sortingMethod, sortOptions);
+    } else if (sortOrder == "carrier-airport-delay") {
+        runSelection<CarrierAirportDelayOrder>(flights, selectedRows, layoutChoice, sortingMethod, sortOptions);
     } else {
-        // FIXME: implement merge sort call
-        mergeSort(averageCaseData, 0, averageCaseData.size() - 1);
+        runSelection<ArrivalDelayOrder>(flights, selectedRows, layoutChoice, sortingMethod, sortOptions);
     }
-
-    end = high_resolution_clock::now();
-    auto durationAverage = duration<double, milli>(end - start);
-    cout << "\nAverage Case (Random Order) Sorting Time: " << durationAverage.count() << " ms" << endl;
-
-    if (!averageCaseData.empty()) {
-        cout << "Shortest delay: " << averageCaseData.front().arr_delay << " minutes" << endl;
-        cout << "Longest delay: " << averageCaseData.back().arr_delay << " minutes" << endl;
+    reportDelaySelection(flights, selectedRows);
+    if (flights.delayPartitions && partitions != nullptr) {
+        reportDelayPartition(flights, *partitions, partitionId);
     }
 
     return 0;